@@ -7,25 +7,47 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-static ssize_t recv_line(int sock, char *buf, size_t maxlen) {
+typedef struct {
+    int sock;
+    char data[4096];
+    size_t start, end;
+} Reader;
+
+static ssize_t reader_fill(Reader *rd) {
+    if (rd->start == rd->end) rd->start = rd->end = 0;
+    ssize_t r = recv(rd->sock, rd->data + rd->end, sizeof(rd->data) - rd->end, 0);
+    if (r > 0) rd->end += r;
+    return r;
+}
+static ssize_t recv_line(Reader *rd, char *buf, size_t maxlen) {
     size_t n = 0;
-    char c;
     while (n + 1 < maxlen) {
-        ssize_t r = recv(sock, &c, 1, 0);
-        if (r <= 0) return -1;
+        if (rd->start == rd->end && reader_fill(rd) <= 0) return -1;
+        char c = rd->data[rd->start++];
         buf[n++] = c;
         if (c == '\n') break;
     }
     buf[n] = '\0';
     return (ssize_t)n;
 }
-static ssize_t recv_all(int sock, void *buf, size_t len) {
+static ssize_t recv_all(Reader *rd, void *buf, size_t len) {
     size_t total = 0;
     char *p = buf;
     while (total < len) {
-        ssize_t r = recv(sock, p + total, len - total, 0);
-        if (r <= 0) return -1;
-        total += r;
+        if (rd->start == rd->end) {
+            if (len - total >= sizeof(rd->data)) {
+                ssize_t r = recv(rd->sock, p + total, len - total, 0);
+                if (r <= 0) return -1;
+                total += r;
+                continue;
+            }
+            if (reader_fill(rd) <= 0) return -1;
+        }
+        size_t n = rd->end - rd->start;
+        if (n > len - total) n = len - total;
+        memcpy(p + total, rd->data + rd->start, n);
+        rd->start += n;
+        total += n;
     }
     return (ssize_t)total;
 }
@@ -39,6 +61,9 @@ static ssize_t send_all(int sock, const void *buf, size_t len) {
     }
     return (ssize_t)total;
 }
+static ssize_t send_str(int sock, const char *s) {
+    return send_all(sock, s, strlen(s));
+}
 
 int main(void) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -50,35 +75,36 @@ int main(void) {
     if (connect(sock, (struct sockaddr*)&sa, sizeof(sa)) < 0) { perror("connect"); return 1; }
 
     char buf[1024];
+    Reader rd = { .sock = sock };
 
-    send_all(sock, "SIGNUP alice\n", 13);
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { perror("recv"); close(sock); return 1; }
+    send_str(sock, "SIGNUP alice\n");
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { perror("recv"); close(sock); return 1; }
     printf("SIGNUP -> %s", buf);
 
-    send_all(sock, "LOGIN alice\n", 12);
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { perror("recv login"); close(sock); return 1; }
+    send_str(sock, "LOGIN alice\n");
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { perror("recv login"); close(sock); return 1; }
     printf("LOGIN -> %s", buf);
 
-    send_all(sock, "UPLOAD alice hello.txt 5\n", 24);
-    send_all(sock, "hello", 5);
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { perror("recv upload"); close(sock); return 1; }
+    send_str(sock, "UPLOAD alice hello.txt 5\n");
+    send_str(sock, "hello");
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { perror("recv upload"); close(sock); return 1; }
     printf("UPLOAD -> %s", buf);
 
-    send_all(sock, "LIST alice\n", 11);
+    send_str(sock, "LIST alice\n");
     printf("LIST ->\n");
     while (1) {
-        if (recv_line(sock, buf, sizeof(buf)) <= 0) { perror("recv list"); close(sock); return 1; }
+        if (recv_line(&rd, buf, sizeof(buf)) <= 0) { perror("recv list"); close(sock); return 1; }
         if (strcmp(buf, "END\n") == 0) break;
         printf("%s", buf);
     }
 
-    send_all(sock, "DOWNLOAD alice hello.txt\n", 24);
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { perror("recv download header"); close(sock); return 1; }
+    send_str(sock, "DOWNLOAD alice hello.txt\n");
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { perror("recv download header"); close(sock); return 1; }
     if (strncmp(buf, "OK ", 3) == 0) {
         size_t sz = 0;
         sscanf(buf+3, "%zu", &sz);
         char *data = malloc(sz+1);
-        if (recv_all(sock, data, sz) <= 0) { perror("recv file"); free(data); close(sock); return 1; }
+        if (recv_all(&rd, data, sz) <= 0) { perror("recv file"); free(data); close(sock); return 1; }
         data[sz] = '\0';
         printf("DOWNLOAD content (%zu bytes): %s\n", sz, data);
         free(data);
@@ -86,8 +112,8 @@ int main(void) {
         printf("DOWNLOAD -> %s", buf);
     }
 
-    send_all(sock, "DELETE alice hello.txt\n", 22);
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { perror("recv delete"); close(sock); return 1; }
+    send_str(sock, "DELETE alice hello.txt\n");
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { perror("recv delete"); close(sock); return 1; }
     printf("DELETE -> %s", buf);
 
     close(sock);
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "filelock.h"
+#include "blobs.h"
+
+/*
+ * A blob lives at storage/.blobs/<first two hex digits>/<hex digest>.
+ * Linking to a blob and dropping an unreferenced one both happen under the
+ * blob's entry in the file-lock table, keyed by an empty user name that no
+ * account can have, so a blob is never removed between being found and
+ * being linked to.
+ *
+ * Uploads and deletes keep link counts exact while the server runs. Blobs
+ * orphaned by a crash between those steps, or whose digest was lost when
+ * the registry was rebuilt from storage/, are swept on a background thread
+ * at startup.
+ */
+
+#define BLOB_DIR "storage/.blobs"
+
+static pthread_t sweep_thread;
+static int sweep_started;
+
+static void blob_path(const char *hex, char *out, size_t len) {
+    snprintf(out, len, BLOB_DIR "/%.2s/%s", hex, hex);
+}
+
+static FileLock *blob_lock(const char *hex) {
+    FileLock *fl = get_file_lock("", hex);
+    if (fl) file_wrlock(fl);
+    return fl;
+}
+
+static void blob_unlock(FileLock *fl) {
+    file_unlock(fl);
+    release_file_lock(fl);
+}
+
+int blob_adopt(const char *path, const unsigned char digest[SHA256_LEN]) {
+    char hex[2 * SHA256_LEN + 1], bpath[128];
+    sha256_hex(digest, hex);
+    blob_path(hex, bpath, sizeof(bpath));
+    FileLock *fl = blob_lock(hex);
+    if (!fl) return -1;
+    int rc = link(path, bpath);
+    if (rc != 0 && errno == EEXIST) {
+        rc = unlink(path);
+        if (rc == 0) rc = link(bpath, path);
+    }
+    blob_unlock(fl);
+    return rc;
+}
+
+int blob_link(const unsigned char digest[SHA256_LEN], const char *path) {
+    char hex[2 * SHA256_LEN + 1], bpath[128];
+    sha256_hex(digest, hex);
+    blob_path(hex, bpath, sizeof(bpath));
+    FileLock *fl = blob_lock(hex);
+    if (!fl) return -1;
+    unlink(path);
+    int rc = link(bpath, path);
+    int err = errno;
+    blob_unlock(fl);
+    errno = err;
+    return rc;
+}
+
+static int release_hex(const char *hex) {
+    char bpath[128];
+    blob_path(hex, bpath, sizeof(bpath));
+    FileLock *fl = blob_lock(hex);
+    if (!fl) return 0;
+    struct stat st;
+    int removed = stat(bpath, &st) == 0 && st.st_nlink == 1 && unlink(bpath) == 0;
+    blob_unlock(fl);
+    return removed;
+}
+
+void blob_release(const unsigned char digest[SHA256_LEN]) {
+    char hex[2 * SHA256_LEN + 1];
+    sha256_hex(digest, hex);
+    release_hex(hex);
+}
+
+static size_t blobs_sweep(void) {
+    size_t removed = 0;
+    char dir[64];
+    unsigned char d[SHA256_LEN];
+    for (int i = 0; i < 256; ++i) {
+        snprintf(dir, sizeof(dir), BLOB_DIR "/%02x", i);
+        DIR *dp = opendir(dir);
+        if (!dp) continue;
+        struct dirent *de;
+        while ((de = readdir(dp)))
+            if (sha256_parse(de->d_name, d) == 0) removed += release_hex(de->d_name);
+        closedir(dp);
+    }
+    return removed;
+}
+
+static void *sweep_thread_fn(void *arg) {
+    (void)arg;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    size_t n = blobs_sweep();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (n) printf("blobs: swept %zu unreferenced blobs in %.3fs\n", n,
+                  (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    return NULL;
+}
+
+int blobs_open(void) {
+    char dir[64];
+    mkdir("storage", 0755);
+    if (mkdir(BLOB_DIR, 0755) != 0 && errno != EEXIST) return -1;
+    for (int i = 0; i < 256; ++i) {
+        snprintf(dir, sizeof(dir), BLOB_DIR "/%02x", i);
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+    }
+    sweep_started = pthread_create(&sweep_thread, NULL, sweep_thread_fn, NULL) == 0;
+    return 0;
+}
+
+void blobs_close(void) {
+    if (sweep_started) pthread_join(sweep_thread, NULL);
+    sweep_started = 0;
+}
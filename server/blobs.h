@@ -0,0 +1,25 @@
+#ifndef BLOBS_H
+#define BLOBS_H
+
+#include "sha256.h"
+
+/*
+ * Content-addressed blob store under storage/.blobs. A user's file is a
+ * hard link to the blob holding its content, so identical uploads share
+ * one copy on disk and the blob's link count is its reference count.
+ */
+
+/* Creates the store and starts sweeping out unreferenced blobs in the
+ * background; blobs_close waits for that sweep. */
+int blobs_open(void);
+void blobs_close(void);
+/* Turns the file at path into a link to the blob for digest, storing it
+ * as that blob if there is none yet. */
+int blob_adopt(const char *path, const unsigned char digest[SHA256_LEN]);
+/* Replaces path with a new link to an existing blob; -1 with errno
+ * ENOENT if there is no such blob. */
+int blob_link(const unsigned char digest[SHA256_LEN], const char *path);
+/* Removes the blob once no user file links to it any more. */
+void blob_release(const unsigned char digest[SHA256_LEN]);
+
+#endif
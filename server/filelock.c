@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "users.h"
+#include "filelock.h"
+
+/*
+ * Lock table: FILELOCK_SHARDS shards picked by the top bits of the key
+ * hash, each with its own mutex, a small chained hash of live entries and
+ * a free list. Entries are cache-line aligned and carved from slabs; an
+ * entry whose last reference is dropped goes back to its shard's free
+ * list with its mutex and condvar still initialised, so the steady state
+ * does no allocation. A release goes straight to the entry's shard with
+ * no key rebuild or search.
+ */
+
+#define FILELOCK_SHARDS 256
+#define FILELOCK_SHARD_BITS 8
+#define FILELOCK_BUCKETS 32
+#define FILELOCK_SLAB 16
+
+struct FileLock {
+    pthread_mutex_t m;
+    pthread_cond_t cv;
+    int readers;
+    int writer;
+    int writers_waiting;
+    int refcount;
+    uint64_t hash;
+    unsigned shard;
+    struct FileLock *next;
+    char key[MAX_USERNAME + 1 + MAX_FILENAME];
+} __attribute__((aligned(64)));
+
+typedef struct LockSlab {
+    struct LockSlab *next;
+    FileLock entry[FILELOCK_SLAB];
+} LockSlab;
+
+typedef struct {
+    pthread_mutex_t m;
+    FileLock *bucket[FILELOCK_BUCKETS];
+    FileLock *free;
+    LockSlab *slabs;
+} __attribute__((aligned(64))) LockShard;
+
+static LockShard shards[FILELOCK_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void shards_init(void) {
+    for (int i = 0; i < FILELOCK_SHARDS; ++i) pthread_mutex_init(&shards[i].m, NULL);
+}
+
+static uint64_t key_hash(const char *user, const char *fname) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*user) { h ^= (unsigned char)*user++; h *= 1099511628211ULL; }
+    h ^= '/'; h *= 1099511628211ULL;
+    while (*fname) { h ^= (unsigned char)*fname++; h *= 1099511628211ULL; }
+    return h ^ (h >> 29);
+}
+
+static int key_matches(const FileLock *e, const char *user, size_t ulen, const char *fname) {
+    return memcmp(e->key, user, ulen) == 0 && e->key[ulen] == '/' && strcmp(e->key + ulen + 1, fname) == 0;
+}
+
+/* Called with sh->m held. */
+static FileLock *shard_alloc(LockShard *sh, unsigned idx) {
+    if (!sh->free) {
+        LockSlab *s = aligned_alloc(64, sizeof(LockSlab));
+        if (!s) return NULL;
+        memset(s, 0, sizeof(LockSlab));
+        for (int i = 0; i < FILELOCK_SLAB; ++i) {
+            FileLock *e = &s->entry[i];
+            pthread_mutex_init(&e->m, NULL);
+            pthread_cond_init(&e->cv, NULL);
+            e->shard = idx;
+            e->next = sh->free;
+            sh->free = e;
+        }
+        s->next = sh->slabs;
+        sh->slabs = s;
+    }
+    FileLock *e = sh->free;
+    sh->free = e->next;
+    return e;
+}
+
+FileLock *get_file_lock(const char *user, const char *fname) {
+    pthread_once(&shards_once, shards_init);
+    size_t ulen = strlen(user), flen = strlen(fname);
+    if (ulen >= MAX_USERNAME || flen >= MAX_FILENAME) return NULL;
+    uint64_t h = key_hash(user, fname);
+    unsigned idx = (unsigned)(h >> (64 - FILELOCK_SHARD_BITS));
+    LockShard *sh = &shards[idx];
+    FileLock **bucket = &sh->bucket[h % FILELOCK_BUCKETS];
+
+    pthread_mutex_lock(&sh->m);
+    for (FileLock *e = *bucket; e; e = e->next) {
+        if (e->hash == h && key_matches(e, user, ulen, fname)) {
+            e->refcount++;
+            pthread_mutex_unlock(&sh->m);
+            return e;
+        }
+    }
+    FileLock *e = shard_alloc(sh, idx);
+    if (!e) { pthread_mutex_unlock(&sh->m); return NULL; }
+    memcpy(e->key, user, ulen);
+    e->key[ulen] = '/';
+    memcpy(e->key + ulen + 1, fname, flen + 1);
+    e->hash = h;
+    e->refcount = 1;
+    e->next = *bucket;
+    *bucket = e;
+    pthread_mutex_unlock(&sh->m);
+    return e;
+}
+
+void release_file_lock(FileLock *fl) {
+    LockShard *sh = &shards[fl->shard];
+    pthread_mutex_lock(&sh->m);
+    if (--fl->refcount == 0) {
+        FileLock **pp = &sh->bucket[fl->hash % FILELOCK_BUCKETS];
+        while (*pp != fl) pp = &(*pp)->next;
+        *pp = fl->next;
+        fl->next = sh->free;
+        sh->free = fl;
+    }
+    pthread_mutex_unlock(&sh->m);
+}
+
+void file_rdlock(FileLock *l) {
+    pthread_mutex_lock(&l->m);
+    while (l->writer || l->writers_waiting) pthread_cond_wait(&l->cv, &l->m);
+    l->readers++;
+    pthread_mutex_unlock(&l->m);
+}
+
+void file_wrlock(FileLock *l) {
+    pthread_mutex_lock(&l->m);
+    l->writers_waiting++;
+    while (l->writer || l->readers) pthread_cond_wait(&l->cv, &l->m);
+    l->writers_waiting--;
+    l->writer = 1;
+    pthread_mutex_unlock(&l->m);
+}
+
+void file_unlock(FileLock *l) {
+    pthread_mutex_lock(&l->m);
+    if (l->writer) l->writer = 0;
+    else l->readers--;
+    if (!l->writer && !l->readers) pthread_cond_broadcast(&l->cv);
+    pthread_mutex_unlock(&l->m);
+}
+
+void filelocks_destroy(void) {
+    pthread_once(&shards_once, shards_init);
+    for (int i = 0; i < FILELOCK_SHARDS; ++i) {
+        LockShard *sh = &shards[i];
+        pthread_mutex_lock(&sh->m);
+        while (sh->slabs) {
+            LockSlab *s = sh->slabs;
+            sh->slabs = s->next;
+            for (int j = 0; j < FILELOCK_SLAB; ++j) {
+                pthread_mutex_destroy(&s->entry[j].m);
+                pthread_cond_destroy(&s->entry[j].cv);
+            }
+            free(s);
+        }
+        memset(sh->bucket, 0, sizeof(sh->bucket));
+        sh->free = NULL;
+        pthread_mutex_unlock(&sh->m);
+    }
+}
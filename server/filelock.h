@@ -0,0 +1,24 @@
+#ifndef FILELOCK_H
+#define FILELOCK_H
+
+/*
+ * Per-file reader/writer locks, keyed by user and file name. A lock may be
+ * released by a thread other than the one that took it: a DOWNLOAD takes
+ * the read lock in a worker and the sender drops it once the body is out.
+ * Waiting writers hold off new readers.
+ */
+typedef struct FileLock FileLock;
+
+/* Takes a reference on the lock for user/fname, creating it if needed. */
+FileLock *get_file_lock(const char *user, const char *fname);
+/* Drops the reference taken by get_file_lock. */
+void release_file_lock(FileLock *fl);
+
+void file_rdlock(FileLock *fl);
+void file_wrlock(FileLock *fl);
+void file_unlock(FileLock *fl);
+
+/* Frees every entry. Only safe once all threads are done. */
+void filelocks_destroy(void);
+
+#endif
@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "users.h"
+#include "meta.h"
+
+/*
+ * Every record is a fixed header followed by the user and file names,
+ * with an FNV-1a checksum over everything after the checksum field, so a
+ * torn or garbled tail is recognised and cut off at load time. PUT
+ * carries the file's new size, PUTD the size and the content digest after
+ * the names, and DEL removes it; all are absolute, so replaying a record
+ * twice gives the same state.
+ *
+ * Journals are numbered. A snapshot first switches appends to journal
+ * gen+1 and then dumps the live registry, one user at a time under its
+ * lock, into a file tagged gen+1. The dump may already include some of
+ * the changes in the new journal, which is harmless: loading replays the
+ * snapshot and then every journal from its generation on. Older journals
+ * are removed once the snapshot is renamed into place.
+ */
+
+#define META_DIR "storage/.meta"
+#define META_SNAPSHOT META_DIR "/snapshot"
+#define META_SNAPSHOT_TMP META_DIR "/snapshot.tmp"
+#define META_MAGIC "DBXMETA1"
+#define META_SNAPSHOT_BYTES (64*1024*1024)
+#define META_SNAPSHOT_INTERVAL 300
+#define META_WRITE_BUF (1024*1024)
+#define META_MAX_JOURNALS 256
+
+enum { META_USER = 1, META_PUT = 2, META_DEL = 3, META_PUTD = 4 };
+
+typedef struct {
+    uint32_t check;
+    uint8_t op;
+    uint8_t ulen;
+    uint16_t flen;
+    uint64_t size;
+} MetaRec;
+
+typedef struct {
+    char magic[8];
+    uint64_t gen;
+} SnapHeader;
+
+#define META_REC_MAX (sizeof(MetaRec) + MAX_USERNAME + MAX_FILENAME + SHA256_LEN)
+
+static pthread_mutex_t journal_m = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_cv = PTHREAD_COND_INITIALIZER;
+static int journal_fd = -1;
+static uint64_t journal_gen;
+static size_t journal_bytes;
+static int meta_stopping;
+static pthread_t meta_thread;
+
+static uint32_t rec_check(const char *p, size_t n) {
+    uint32_t h = 2166136261u;
+    while (n--) { h ^= (unsigned char)*p++; h *= 16777619u; }
+    return h;
+}
+
+static size_t rec_encode(char *buf, int op, const char *user, const char *fname, uint64_t size,
+                         const unsigned char *digest) {
+    size_t ulen = strlen(user), flen = fname ? strlen(fname) : 0;
+    if (op == META_PUT && digest) op = META_PUTD;
+    MetaRec r = { 0, (uint8_t)op, (uint8_t)ulen, (uint16_t)flen, size };
+    memcpy(buf, &r, sizeof(r));
+    memcpy(buf + sizeof(r), user, ulen);
+    if (flen) memcpy(buf + sizeof(r) + ulen, fname, flen);
+    size_t n = sizeof(r) + ulen + flen;
+    if (op == META_PUTD) {
+        memcpy(buf + n, digest, SHA256_LEN);
+        n += SHA256_LEN;
+    }
+    r.check = rec_check(buf + sizeof(r.check), n - sizeof(r.check));
+    memcpy(buf, &r.check, sizeof(r.check));
+    return n;
+}
+
+/* Length of the valid record at p, or 0 if it is torn or corrupt. The
+ * checksum is skipped for bytes that were already verified. */
+static size_t rec_decode(const char *p, size_t avail, MetaRec *r, int verify) {
+    if (avail < sizeof(MetaRec)) return 0;
+    memcpy(r, p, sizeof(MetaRec));
+    size_t n = sizeof(MetaRec) + r->ulen + r->flen + (r->op == META_PUTD ? SHA256_LEN : 0);
+    if (n > avail || r->ulen == 0 || r->ulen >= MAX_USERNAME || r->flen >= MAX_FILENAME) return 0;
+    if (r->op < META_USER || r->op > META_PUTD) return 0;
+    if (r->op != META_USER && r->flen == 0) return 0;
+    if (verify && rec_check(p + sizeof(r->check), n - sizeof(r->check)) != r->check) return 0;
+    return n;
+}
+
+/* Applies records from p; returns how many bytes were valid. A verified
+ * snapshot range holds each file once, so its entries are added without
+ * looking for an existing one first. */
+static size_t replay(const char *p, size_t len, int snapshot, size_t *nrecs) {
+    size_t off = 0;
+    User *u = NULL;
+    char user[MAX_USERNAME], name[MAX_FILENAME];
+    while (off < len) {
+        MetaRec r;
+        size_t n = rec_decode(p + off, len - off, &r, !snapshot);
+        if (!n) break;
+        memcpy(user, p + off + sizeof(r), r.ulen);
+        user[r.ulen] = '\0';
+        if (!u || strcmp(u->username, user) != 0) {
+            u = find_user(user);
+            if (!u) u = users_insert(user);
+            if (!u) break;
+        }
+        if (r.op != META_USER) {
+            memcpy(name, p + off + sizeof(r) + r.ulen, r.flen);
+            name[r.flen] = '\0';
+            if (r.op == META_DEL) {
+                remove_file_from_user(u, name);
+            } else {
+                FileEntry *f = snapshot ? add_file_to_user(u, name, (size_t)r.size)
+                                        : set_user_file(u, name, (size_t)r.size);
+                if (f && r.op == META_PUTD) memcpy(f->digest, p + off + sizeof(r) + r.ulen + r.flen, SHA256_LEN);
+            }
+        }
+        off += n;
+        (*nrecs)++;
+    }
+    return off;
+}
+
+typedef struct {
+    const char *p;
+    size_t len;
+    size_t nrecs;
+    pthread_t th;
+} ReplayPart;
+
+static void *replay_part_fn(void *arg) {
+    ReplayPart *rp = arg;
+    replay(rp->p, rp->len, 1, &rp->nrecs);
+    return NULL;
+}
+
+/* Verifies the snapshot records in one pass, then replays them on up to
+ * nthreads threads. A snapshot keeps each user's records together behind
+ * its USER record, so splitting only there gives every user to exactly
+ * one thread. Returns how many bytes were valid. */
+static size_t replay_snapshot(const char *p, size_t len, int nthreads, size_t *nrecs) {
+    if (nthreads < 1) nthreads = 1;
+    ReplayPart parts[nthreads];
+    int nparts = 0;
+    size_t off = 0, start = 0;
+    MetaRec r;
+    while (off < len) {
+        size_t n = rec_decode(p + off, len - off, &r, 1);
+        if (!n) break;
+        if (r.op == META_USER && nparts < nthreads - 1 && off - start >= len / nthreads) {
+            parts[nparts++] = (ReplayPart){ p + start, off - start, 0, 0 };
+            start = off;
+        }
+        off += n;
+    }
+    parts[nparts++] = (ReplayPart){ p + start, off - start, 0, 0 };
+    int started = 1;
+    for (; started < nparts; ++started)
+        if (pthread_create(&parts[started].th, NULL, replay_part_fn, &parts[started]) != 0) break;
+    for (int i = started; i < nparts; ++i) replay_part_fn(&parts[i]);
+    replay_part_fn(&parts[0]);
+    for (int i = 1; i < started; ++i) pthread_join(parts[i].th, NULL);
+    for (int i = 0; i < nparts; ++i) *nrecs += parts[i].nrecs;
+    return off;
+}
+
+static const char *map_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); *len = 0; return NULL; }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *len = (size_t)st.st_size;
+    return p;
+}
+
+static void journal_path(char *buf, size_t len, uint64_t gen) {
+    snprintf(buf, len, META_DIR "/journal.%llu", (unsigned long long)gen);
+}
+
+static int cmp_gen(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Generations of the journals on disk, ascending. */
+static int list_journals(uint64_t *gens, int max) {
+    DIR *d = opendir(META_DIR);
+    if (!d) return 0;
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) && n < max) {
+        unsigned long long g;
+        char tail;
+        if (sscanf(de->d_name, "journal.%llu%c", &g, &tail) == 1) gens[n++] = g;
+    }
+    closedir(d);
+    qsort(gens, n, sizeof(uint64_t), cmp_gen);
+    return n;
+}
+
+static void remove_journals_before(uint64_t gen) {
+    uint64_t gens[META_MAX_JOURNALS];
+    int n = list_journals(gens, META_MAX_JOURNALS);
+    char path[128];
+    for (int i = 0; i < n && gens[i] < gen; ++i) {
+        journal_path(path, sizeof(path), gens[i]);
+        unlink(path);
+    }
+}
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    int err;
+} SnapWriter;
+
+static void snap_flush(SnapWriter *w) {
+    size_t off = 0;
+    while (!w->err && off < w->len) {
+        ssize_t n = write(w->fd, w->buf + off, w->len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) w->err = 1;
+        else off += (size_t)n;
+    }
+    w->len = 0;
+}
+
+static void snap_put(SnapWriter *w, const char *p, size_t n) {
+    if (w->len + n > META_WRITE_BUF) snap_flush(w);
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static void snap_user(User *u, void *arg) {
+    SnapWriter *w = arg;
+    char rec[META_REC_MAX];
+    pthread_mutex_lock(&u->lock);
+    snap_put(w, rec, rec_encode(rec, META_USER, u->username, NULL, 0, NULL));
+    FileIndex *ix = &u->files;
+    for (size_t i = 0; ix->buckets && i <= ix->mask; ++i)
+        for (FileEntry *f = ix->buckets[i]; f; f = f->hnext)
+            snap_put(w, rec, rec_encode(rec, META_PUT, u->username, f->name, f->size,
+                                        file_has_digest(f) ? f->digest : NULL));
+    pthread_mutex_unlock(&u->lock);
+}
+
+static int snapshot_write(uint64_t gen) {
+    SnapWriter w = { -1, malloc(META_WRITE_BUF), 0, 0 };
+    if (!w.buf) return -1;
+    w.fd = open(META_SNAPSHOT_TMP, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w.fd < 0) { free(w.buf); return -1; }
+    SnapHeader h;
+    memcpy(h.magic, META_MAGIC, sizeof(h.magic));
+    h.gen = gen;
+    snap_put(&w, (const char *)&h, sizeof(h));
+    users_foreach(snap_user, &w);
+    snap_flush(&w);
+    free(w.buf);
+    if (w.err || fsync(w.fd) != 0) { close(w.fd); unlink(META_SNAPSHOT_TMP); return -1; }
+    close(w.fd);
+    if (rename(META_SNAPSHOT_TMP, META_SNAPSHOT) != 0) { unlink(META_SNAPSHOT_TMP); return -1; }
+    int dfd = open(META_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+    return 0;
+}
+
+static int journal_open(uint64_t gen) {
+    char path[128];
+    journal_path(path, sizeof(path), gen);
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+/* Rotates the journal and folds everything before it into a snapshot. */
+static int meta_snapshot(void) {
+    pthread_mutex_lock(&journal_m);
+    uint64_t gen = journal_gen + 1;
+    int fd = journal_open(gen);
+    if (fd < 0) { pthread_mutex_unlock(&journal_m); return -1; }
+    int old = journal_fd;
+    journal_fd = fd;
+    journal_gen = gen;
+    journal_bytes = 0;
+    pthread_mutex_unlock(&journal_m);
+    if (old >= 0) { fsync(old); close(old); }
+    if (snapshot_write(gen) != 0) return -1;
+    remove_journals_before(gen);
+    return 0;
+}
+
+static void journal_append(const char *rec, size_t n) {
+    pthread_mutex_lock(&journal_m);
+    if (journal_fd >= 0 && write(journal_fd, rec, n) == (ssize_t)n) {
+        journal_bytes += n;
+        if (journal_bytes >= META_SNAPSHOT_BYTES && journal_bytes - n < META_SNAPSHOT_BYTES)
+            pthread_cond_signal(&journal_cv);
+    }
+    pthread_mutex_unlock(&journal_m);
+}
+
+void meta_log_user(const char *user) {
+    char rec[META_REC_MAX];
+    journal_append(rec, rec_encode(rec, META_USER, user, NULL, 0, NULL));
+}
+
+void meta_log_put(const char *user, const char *fname, size_t size, const unsigned char *digest) {
+    char rec[META_REC_MAX];
+    journal_append(rec, rec_encode(rec, META_PUT, user, fname, size, digest));
+}
+
+void meta_log_del(const char *user, const char *fname) {
+    char rec[META_REC_MAX];
+    journal_append(rec, rec_encode(rec, META_DEL, user, fname, 0, NULL));
+}
+
+/* Snapshots once the journal is large, or every META_SNAPSHOT_INTERVAL
+ * seconds if anything was logged at all. */
+static void *meta_thread_fn(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&journal_m);
+    while (!meta_stopping) {
+        int rc = 0;
+        if (journal_bytes < META_SNAPSHOT_BYTES) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += META_SNAPSHOT_INTERVAL;
+            rc = pthread_cond_timedwait(&journal_cv, &journal_m, &ts);
+        }
+        if (meta_stopping) break;
+        if (journal_bytes >= META_SNAPSHOT_BYTES || (rc == ETIMEDOUT && journal_bytes > 0)) {
+            pthread_mutex_unlock(&journal_m);
+            if (meta_snapshot() != 0) perror("meta snapshot");
+            pthread_mutex_lock(&journal_m);
+        }
+    }
+    pthread_mutex_unlock(&journal_m);
+    return NULL;
+}
+
+typedef struct {
+    DIR *d;
+    pthread_mutex_t m;
+    size_t users, files;
+} ScanState;
+
+static void scan_user(ScanState *s, const char *uname) {
+    if (strlen(uname) >= MAX_USERNAME) return;
+    int dfd = openat(dirfd(s->d), uname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;
+    DIR *ud = fdopendir(dfd);
+    if (!ud) { close(dfd); return; }
+    User *u = find_user(uname);
+    if (!u) u = users_insert(uname);
+    if (!u) { closedir(ud); return; }
+    size_t files = 0;
+    struct dirent *de;
+    while ((de = readdir(ud))) {
+        if (de->d_name[0] == '.') {
+            if (strncmp(de->d_name, ".tmp_", 5) == 0) unlinkat(dfd, de->d_name, 0);
+            continue;
+        }
+        struct stat st;
+        if (strlen(de->d_name) >= MAX_FILENAME) continue;
+        if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+        pthread_mutex_lock(&u->lock);
+        set_user_file(u, de->d_name, (size_t)st.st_size);
+        pthread_mutex_unlock(&u->lock);
+        files++;
+    }
+    closedir(ud);
+    pthread_mutex_lock(&s->m);
+    s->users++;
+    s->files += files;
+    pthread_mutex_unlock(&s->m);
+}
+
+static void *scan_thread_fn(void *arg) {
+    ScanState *s = arg;
+    char name[256];
+    for (;;) {
+        pthread_mutex_lock(&s->m);
+        struct dirent *de;
+        do de = readdir(s->d);
+        while (de && (de->d_name[0] == '.' || (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)));
+        if (de) snprintf(name, sizeof(name), "%s", de->d_name);
+        pthread_mutex_unlock(&s->m);
+        if (!de) return NULL;
+        scan_user(s, name);
+    }
+}
+
+/* Rebuilds the registry from the files under storage/, one user directory
+ * per thread at a time. Leftover upload temp files are removed. */
+static void meta_scan(int nthreads, size_t *users, size_t *files) {
+    ScanState s = { opendir("storage"), PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+    if (!s.d) return;
+    if (nthreads < 1) nthreads = 1;
+    pthread_t th[nthreads];
+    int started = 0;
+    for (; started < nthreads; ++started)
+        if (pthread_create(&th[started], NULL, scan_thread_fn, &s) != 0) break;
+    if (!started) scan_thread_fn(&s);
+    for (int i = 0; i < started; ++i) pthread_join(th[i], NULL);
+    closedir(s.d);
+    *users = s.users;
+    *files = s.files;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int meta_open(int threads) {
+    double t0 = now_sec();
+    mkdir("storage", 0755);
+    if (mkdir(META_DIR, 0755) != 0 && errno != EEXIST) return -1;
+
+    uint64_t gen = 0;
+    size_t nrecs = 0, len;
+    int restored = 0;
+    const char *p = map_file(META_SNAPSHOT, &len);
+    if (p) {
+        SnapHeader h = { { 0 }, 0 };
+        if (len >= sizeof(h)) memcpy(&h, p, sizeof(h));
+        if (memcmp(h.magic, META_MAGIC, sizeof(h.magic)) == 0) {
+            gen = h.gen;
+            if (replay_snapshot(p + sizeof(h), len - sizeof(h), threads, &nrecs) != len - sizeof(h))
+                fprintf(stderr, "meta: snapshot truncated after %zu records\n", nrecs);
+            restored = 1;
+        }
+        munmap((void *)p, len);
+    }
+
+    uint64_t gens[META_MAX_JOURNALS];
+    int nj = list_journals(gens, META_MAX_JOURNALS);
+    char path[128];
+    for (int i = 0; i < nj; ++i) {
+        if (gens[i] < gen) continue;
+        journal_path(path, sizeof(path), gens[i]);
+        p = map_file(path, &len);
+        size_t good = p ? replay(p, len, 0, &nrecs) : 0;
+        if (p) munmap((void *)p, len);
+        if (good < len) {
+            fprintf(stderr, "meta: %s: dropping %zu bytes of torn records\n", path, len - good);
+            if (truncate(path, (off_t)good) != 0) perror("meta truncate");
+        }
+        gen = gens[i];
+        restored = 1;
+    }
+
+    if (!restored) {
+        size_t users = 0, files = 0;
+        meta_scan(threads, &users, &files);
+        gen = 1;
+        if (snapshot_write(gen) != 0) return -1;
+        printf("meta: scanned storage/: %zu users, %zu files in %.3fs\n", users, files, now_sec() - t0);
+    } else {
+        printf("meta: restored %zu records in %.3fs\n", nrecs, now_sec() - t0);
+    }
+
+    journal_gen = gen ? gen : 1;
+    journal_fd = journal_open(journal_gen);
+    if (journal_fd < 0) return -1;
+    struct stat st;
+    journal_bytes = fstat(journal_fd, &st) == 0 ? (size_t)st.st_size : 0;
+    meta_stopping = 0;
+    if (pthread_create(&meta_thread, NULL, meta_thread_fn, NULL) != 0) return -1;
+    return 0;
+}
+
+void meta_close(void) {
+    pthread_mutex_lock(&journal_m);
+    meta_stopping = 1;
+    pthread_cond_signal(&journal_cv);
+    pthread_mutex_unlock(&journal_m);
+    pthread_join(meta_thread, NULL);
+    if (meta_snapshot() != 0) perror("meta snapshot");
+    pthread_mutex_lock(&journal_m);
+    if (journal_fd >= 0) { fsync(journal_fd); close(journal_fd); }
+    journal_fd = -1;
+    pthread_mutex_unlock(&journal_m);
+}
@@ -0,0 +1,26 @@
+#ifndef META_H
+#define META_H
+
+#include <stddef.h>
+
+/*
+ * Persistent user and file metadata under storage/.meta: an append-only
+ * journal of changes plus a compact snapshot that the journal is folded
+ * into from time to time and at shutdown.
+ */
+
+/* Restores the registry from the snapshot and journals, or rebuilds it by
+ * scanning storage/ when neither exists, using up to `threads` threads;
+ * then opens the journal for appends. Call before any other thread starts. */
+int meta_open(int threads);
+/* Writes a final snapshot and closes the journal. */
+void meta_close(void);
+
+/* Journal one change. PUT and DEL are logged with the owner's u->lock held
+ * so the journal order per file matches the in-memory order. digest may be
+ * NULL when the content hash is not known. */
+void meta_log_user(const char *user);
+void meta_log_put(const char *user, const char *fname, size_t size, const unsigned char *digest);
+void meta_log_del(const char *user, const char *fname);
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include "pool.h"
+
+/* A slab is one 64-byte header line holding the slab list link, followed
+ * by per_slab objects. A free object's first word links the free list. */
+
+#define POOL_ALIGN 64
+
+void pool_init(Pool *p, size_t size, size_t per_slab) {
+    p->size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    p->per_slab = per_slab ? per_slab : 1;
+    p->free = NULL;
+    p->slabs = NULL;
+    p->nslabs = 0;
+    p->gets = 0;
+}
+
+static int pool_grow(Pool *p) {
+    char *s = aligned_alloc(POOL_ALIGN, POOL_ALIGN + p->size * p->per_slab);
+    if (!s) return -1;
+    *(void **)s = p->slabs;
+    p->slabs = s;
+    p->nslabs++;
+    for (size_t i = p->per_slab; i-- > 0; ) {
+        void *obj = s + POOL_ALIGN + i * p->size;
+        *(void **)obj = p->free;
+        p->free = obj;
+    }
+    return 0;
+}
+
+void *pool_get(Pool *p) {
+    if (!p->free && pool_grow(p) != 0) return NULL;
+    void *obj = p->free;
+    p->free = *(void **)obj;
+    p->gets++;
+    return obj;
+}
+
+void pool_put(Pool *p, void *obj) {
+    if (!obj) return;
+    *(void **)obj = p->free;
+    p->free = obj;
+}
+
+void pool_destroy(Pool *p) {
+    while (p->slabs) {
+        void *s = p->slabs;
+        p->slabs = *(void **)s;
+        free(s);
+    }
+    p->free = NULL;
+    p->nslabs = 0;
+}
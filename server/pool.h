@@ -0,0 +1,29 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Fixed-size object pool owned by one thread. Objects are carved from
+ * cache-line aligned slabs and go back on a free list, so once a pool has
+ * grown to its working set, get and put never call the allocator. There is
+ * no locking: other threads hand objects back to the owner instead.
+ */
+typedef struct Pool {
+    size_t size;
+    size_t per_slab;
+    void *free;
+    void *slabs;
+    size_t nslabs;
+    size_t gets;
+} Pool;
+
+/* size is rounded up to a multiple of 64. */
+void pool_init(Pool *p, size_t size, size_t per_slab);
+/* Uninitialised object, or NULL if a new slab could not be allocated. */
+void *pool_get(Pool *p);
+void pool_put(Pool *p, void *obj);
+/* Frees every slab, including objects still out. */
+void pool_destroy(Pool *p);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "queue.h"
+
+/*
+ * The ring follows Vyukov's bounded MPMC queue: each cell carries a
+ * sequence number that says whether it is ready for the producer or the
+ * consumer of a given lap, so a push or pop is one CAS on head or tail
+ * plus a release store on the cell. head and tail sit on their own cache
+ * lines.
+ *
+ * Sleeping is layered on top. A blocked caller registers in pop_waiters
+ * or push_waiters under q->m and retries before waiting; the other side
+ * issues a full fence after its ring operation and only takes q->m to
+ * signal when it sees a waiter, so the uncontended path never touches
+ * the mutex and no wakeup is lost.
+ */
+
+int queue_init(Queue *q, size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    q->cells = malloc(n * sizeof(QueueCell));
+    if (!q->cells) return -1;
+    for (size_t i = 0; i < n; ++i) atomic_init(&q->cells[i].seq, i);
+    q->mask = n - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->pop_waiters, 0);
+    atomic_init(&q->push_waiters, 0);
+    atomic_init(&q->shutting_down, 0);
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->nonempty, NULL);
+    pthread_cond_init(&q->nonfull, NULL);
+    return 0;
+}
+
+void queue_destroy(Queue *q) {
+    free(q->cells);
+    q->cells = NULL;
+    pthread_mutex_destroy(&q->m);
+    pthread_cond_destroy(&q->nonempty);
+    pthread_cond_destroy(&q->nonfull);
+}
+
+static int ring_push(Queue *q, void *v) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    QueueCell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    c->val = v;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static void *ring_pop(Queue *q) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    QueueCell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    void *v = c->val;
+    atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+    return v;
+}
+
+static void wake_one(Queue *q, _Atomic int *waiters, pthread_cond_t *cv) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(waiters, memory_order_relaxed)) return;
+    pthread_mutex_lock(&q->m);
+    pthread_cond_signal(cv);
+    pthread_mutex_unlock(&q->m);
+}
+
+int queue_trypush(Queue *q, void *v) {
+    if (ring_push(q, v) != 0) return -1;
+    wake_one(q, &q->pop_waiters, &q->nonempty);
+    return 0;
+}
+
+void *queue_trypop(Queue *q) {
+    void *v = ring_pop(q);
+    if (v) wake_one(q, &q->push_waiters, &q->nonfull);
+    return v;
+}
+
+int queue_push(Queue *q, void *v) {
+    if (queue_trypush(q, v) == 0) return 0;
+    int rc = -1;
+    pthread_mutex_lock(&q->m);
+    atomic_fetch_add(&q->push_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!atomic_load(&q->shutting_down)) {
+        if (ring_push(q, v) == 0) { rc = 0; break; }
+        pthread_cond_wait(&q->nonfull, &q->m);
+    }
+    atomic_fetch_sub(&q->push_waiters, 1);
+    pthread_mutex_unlock(&q->m);
+    if (rc == 0) wake_one(q, &q->pop_waiters, &q->nonempty);
+    return rc;
+}
+
+void *queue_pop(Queue *q) {
+    void *v = queue_trypop(q);
+    if (v) return v;
+    pthread_mutex_lock(&q->m);
+    atomic_fetch_add(&q->pop_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!(v = ring_pop(q)) && !atomic_load(&q->shutting_down))
+        pthread_cond_wait(&q->nonempty, &q->m);
+    atomic_fetch_sub(&q->pop_waiters, 1);
+    pthread_mutex_unlock(&q->m);
+    if (v) wake_one(q, &q->push_waiters, &q->nonfull);
+    return v;
+}
+
+void queue_wakeup_all(Queue *q) {
+    pthread_mutex_lock(&q->m);
+    atomic_store(&q->shutting_down, 1);
+    pthread_cond_broadcast(&q->nonempty);
+    pthread_cond_broadcast(&q->nonfull);
+    pthread_mutex_unlock(&q->m);
+}
+
+size_t queue_size(Queue *q) {
+    size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return h > t ? h - t : 0;
+}
@@ -0,0 +1,49 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * Bounded multi-producer multi-consumer ring of pointers. The try
+ * variants never block or allocate; the blocking ones sleep only while
+ * the ring is full or empty. Values must not be NULL.
+ */
+
+typedef struct {
+    _Atomic size_t seq;
+    void *val;
+} QueueCell;
+
+typedef struct {
+    QueueCell *cells;
+    size_t mask;
+    _Atomic size_t head __attribute__((aligned(64)));
+    _Atomic size_t tail __attribute__((aligned(64)));
+    _Atomic int pop_waiters __attribute__((aligned(64)));
+    _Atomic int push_waiters;
+    _Atomic int shutting_down;
+    pthread_mutex_t m;
+    pthread_cond_t nonempty;
+    pthread_cond_t nonfull;
+} Queue;
+
+/* capacity is rounded up to a power of two. */
+int queue_init(Queue *q, size_t capacity);
+void queue_destroy(Queue *q);
+
+/* 0 on success, -1 if the queue is full. */
+int queue_trypush(Queue *q, void *v);
+/* Waits for room; -1 if the queue was shut down first. */
+int queue_push(Queue *q, void *v);
+/* NULL if the queue is empty. */
+void *queue_trypop(Queue *q);
+/* Waits for a value; NULL once the queue is shut down and empty. */
+void *queue_pop(Queue *q);
+/* Releases every blocked caller and makes later waits return at once. */
+void queue_wakeup_all(Queue *q);
+/* Number of queued values; only a hint while others are using the queue. */
+size_t queue_size(Queue *q);
+
+#endif
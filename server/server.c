@@ -1,11 +1,17 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
@@ -13,193 +19,105 @@
 #include <fcntl.h>
 #include <time.h>
 #include <limits.h>
+#include <inttypes.h>
+#include "users.h"
+#include "filelock.h"
+#include "meta.h"
+#include "queue.h"
+#include "pool.h"
+#include "blobs.h"
+#include "sessions.h"
 
 #define PORT 9000
-#define BACKLOG 128
-#define CLIENT_POOL_SIZE 8
+#define BACKLOG 1024
+#define REACTOR_POOL_SIZE 2
 #define WORKER_POOL_SIZE 6
 #define SENDER_POOL_SIZE 4
-#define MAX_USERNAME 64
-#define MAX_FILENAME 256
-#define DEFAULT_QUOTA_BYTES (100*1024*1024)
+#define MAX_EVENTS 256
+#define MAX_LINES_PER_EVENT 64
 #define LINEBUF 1024
+#define RECVBUF_SIZE (16*1024)
+#define SENDFILE_CHUNK (1024*1024)
+#define UPLOAD_CHUNK (256*1024)
+#define UPLOAD_READS_PER_EVENT 4
+#define LIST_PAGE_BYTES RECVBUF_SIZE
+#define LIST_LINE_MAX (MAX_FILENAME + 32)
+#define HASH_READ_BUF (64*1024)
+#define CLIENT_Q_CAP 256
+#define TASK_Q_CAP 1024
+#define RESULT_Q_CAP 1024
+#define TASK_SLAB 64
+#define BUF_SLAB 8
 
-static ssize_t recv_line(int sock, char *buf, size_t maxlen) {
-    size_t n = 0;
-    char c;
-    while (n + 1 < maxlen) {
-        ssize_t r = recv(sock, &c, 1, 0);
-        if (r == 0 && n == 0) return 0;
-        if (r <= 0) return -1;
-        buf[n++] = c;
-        if (c == '\n') break;
-    }
-    buf[n] = '\0';
-    return (ssize_t)n;
+static volatile int running = 1;
+
+/*
+ * Per-connection input buffer. The reactor fills it in large chunks and
+ * carves command lines out of it. Payload bytes that arrive together with
+ * an UPLOAD line go straight from here into the upload's temp file. The
+ * storage is only held while it has data and comes from the reactor's
+ * buffer pool.
+ */
+typedef struct RecvBuf {
+    int fd;
+    Pool *pool;
+    char *data;
+    size_t start, end;
+} RecvBuf;
+
+static void rbuf_init(RecvBuf *b, int fd, Pool *pool) {
+    b->fd = fd;
+    b->pool = pool;
+    b->data = NULL;
+    b->start = b->end = 0;
 }
-static ssize_t recv_all(int sock, void *buf, size_t len) {
-    size_t total = 0;
-    char *p = buf;
-    while (total < len) {
-        ssize_t r = recv(sock, p + total, len - total, 0);
-        if (r <= 0) return -1;
-        total += r;
-    }
-    return (ssize_t)total;
+static void rbuf_release(RecvBuf *b) {
+    if (b->start != b->end) return;
+    pool_put(b->pool, b->data);
+    b->data = NULL;
+    b->start = b->end = 0;
 }
-static ssize_t send_all(int sock, const void *buf, size_t len) {
-    size_t total = 0;
-    const char *p = buf;
-    while (total < len) {
-        ssize_t s = send(sock, p + total, len - total, 0);
-        if (s <= 0) return -1;
-        total += s;
-    }
-    return (ssize_t)total;
-}
-
-typedef struct Node {
-    void *val;
-    struct Node *next;
-} Node;
-
-typedef struct {
-    Node *head, *tail;
-    pthread_mutex_t m;
-    pthread_cond_t nonempty;
-    int shutting_down;
-} GenQueue;
-
-static void queue_init(GenQueue *q) {
-    q->head = q->tail = NULL;
-    pthread_mutex_init(&q->m, NULL);
-    pthread_cond_init(&q->nonempty, NULL);
-    q->shutting_down = 0;
-}
-static void queue_push(GenQueue *q, void *v) {
-    Node *n = malloc(sizeof(Node));
-    if (!n) return;
-    n->val = v; n->next = NULL;
-    pthread_mutex_lock(&q->m);
-    if (q->tail) q->tail->next = n; else q->head = n;
-    q->tail = n;
-    pthread_cond_signal(&q->nonempty);
-    pthread_mutex_unlock(&q->m);
-}
-static void *queue_pop(GenQueue *q) {
-    pthread_mutex_lock(&q->m);
-    while (!q->head && !q->shutting_down) pthread_cond_wait(&q->nonempty, &q->m);
-    if (!q->head) {
-        pthread_mutex_unlock(&q->m);
-        return NULL;
-    }
-    Node *n = q->head;
-    q->head = n->next;
-    if (!q->head) q->tail = NULL;
-    pthread_mutex_unlock(&q->m);
-    void *v = n->val;
-    free(n);
-    return v;
-}
-static void queue_wakeup_all(GenQueue *q) {
-    pthread_mutex_lock(&q->m);
-    q->shutting_down = 1;
-    pthread_cond_broadcast(&q->nonempty);
-    pthread_mutex_unlock(&q->m);
-}
-
-typedef struct FileEntry {
-    char name[MAX_FILENAME];
-    size_t size;
-    struct FileEntry *next;
-} FileEntry;
-
-typedef struct User {
-    char username[MAX_USERNAME];
-    size_t quota_bytes;
-    size_t used_bytes;
-    FileEntry *files;
-    pthread_mutex_t lock;
-    struct User *next;
-} User;
-
-static User *users_head = NULL;
-static pthread_mutex_t users_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-typedef struct FileLockEntry {
-    char key[512];
-    pthread_rwlock_t rw;
-    struct FileLockEntry *next;
-    int refcount;
-} FileLockEntry;
-
-static FileLockEntry *filelocks_head = NULL;
-static pthread_mutex_t filelocks_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static pthread_rwlock_t *get_file_lock(const char *user, const char *fname) {
-    char key[512];
-    snprintf(key, sizeof(key), "%s/%s", user, fname);
-    pthread_mutex_lock(&filelocks_mutex);
-    FileLockEntry *e = filelocks_head;
-    while (e) {
-        if (strcmp(e->key, key) == 0) { e->refcount++; pthread_mutex_unlock(&filelocks_mutex); return &e->rw; }
-        e = e->next;
-    }
-    e = calloc(1, sizeof(FileLockEntry));
-    if (!e) { pthread_mutex_unlock(&filelocks_mutex); return NULL; }
-    strncpy(e->key, key, sizeof(e->key)-1);
-    pthread_rwlock_init(&e->rw, NULL);
-    e->refcount = 1;
-    e->next = filelocks_head;
-    filelocks_head = e;
-    pthread_mutex_unlock(&filelocks_mutex);
-    return &e->rw;
-}
-static void release_file_lock(const char *user, const char *fname) {
-    char key[512];
-    snprintf(key, sizeof(key), "%s/%s", user, fname);
-    pthread_mutex_lock(&filelocks_mutex);
-    FileLockEntry *prev = NULL, *cur = filelocks_head;
-    while (cur) {
-        if (strcmp(cur->key, key) == 0) {
-            cur->refcount--;
-            if (cur->refcount == 0) {
-                if (prev) prev->next = cur->next; else filelocks_head = cur->next;
-                pthread_rwlock_destroy(&cur->rw);
-                free(cur);
-            }
-            break;
-        }
-        prev = cur; cur = cur->next;
-    }
-    pthread_mutex_unlock(&filelocks_mutex);
+static void rbuf_destroy(RecvBuf *b) {
+    pool_put(b->pool, b->data);
+    b->data = NULL;
 }
-
-static User *find_user(const char *username) {
-    pthread_mutex_lock(&users_mutex);
-    User *u = users_head;
-    while (u) {
-        if (strcmp(u->username, username) == 0) break;
-        u = u->next;
+/* One recv() into the free tail of the buffer. Returns the byte count, 0 on
+ * EOF, or -1 with errno set (EAGAIN when the socket has nothing). */
+static ssize_t rbuf_fill(RecvBuf *b) {
+    if (!b->data && !(b->data = pool_get(b->pool))) { errno = ENOMEM; return -1; }
+    if (b->start == b->end) {
+        b->start = b->end = 0;
+    } else if (b->end == RECVBUF_SIZE) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+    for (;;) {
+        ssize_t r = recv(b->fd, b->data + b->end, RECVBUF_SIZE - b->end, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r > 0) b->end += (size_t)r;
+        return r;
     }
-    pthread_mutex_unlock(&users_mutex);
-    return u;
 }
-
+/* Copies the next buffered line, '\n' included, into out. A line longer
+ * than maxlen-1 is cut there, as the old byte-wise reader did. Returns its
+ * length, or 0 when no complete line is buffered yet. */
+static size_t rbuf_getline(RecvBuf *b, char *out, size_t maxlen) {
+    size_t avail = b->end - b->start;
+    size_t scan = avail < maxlen - 1 ? avail : maxlen - 1;
+    char *nl = scan ? memchr(b->data + b->start, '\n', scan) : NULL;
+    size_t n;
+    if (nl) n = (size_t)(nl - (b->data + b->start)) + 1;
+    else if (avail >= maxlen - 1) n = maxlen - 1;
+    else return 0;
+    memcpy(out, b->data + b->start, n);
+    out[n] = '\0';
+    b->start += n;
+    return n;
+}
 static int create_user(const char *username) {
-    pthread_mutex_lock(&users_mutex);
-    User *u = users_head;
-    while (u) { if (strcmp(u->username, username)==0) { pthread_mutex_unlock(&users_mutex); return -1; } u=u->next; }
-    User *nu = calloc(1, sizeof(User));
-    if (!nu) { pthread_mutex_unlock(&users_mutex); return -1; }
-    strncpy(nu->username, username, sizeof(nu->username)-1);
-    nu->quota_bytes = DEFAULT_QUOTA_BYTES;
-    nu->used_bytes = 0;
-    nu->files = NULL;
-    pthread_mutex_init(&nu->lock, NULL);
-    nu->next = users_head;
-    users_head = nu;
-    pthread_mutex_unlock(&users_mutex);
+    if (!users_insert(username)) return -1;
+    meta_log_user(username);
     char path[PATH_MAX];
     snprintf(path, sizeof(path), "storage/%s", username);
     mkdir("storage", 0755);
@@ -207,55 +125,37 @@ static int create_user(const char *username) {
     return 0;
 }
 
-static void add_file_to_user(User *u, const char *fname, size_t fsize) {
-    FileEntry *fe = malloc(sizeof(FileEntry));
-    if (!fe) return;
-    strncpy(fe->name, fname, sizeof(fe->name)-1);
-    fe->size = fsize;
-    fe->next = u->files;
-    u->files = fe;
-    u->used_bytes += fsize;
-}
-static int remove_file_from_user(User *u, const char *fname) {
-    FileEntry *prev = NULL, *cur = u->files;
-    while (cur) {
-        if (strcmp(cur->name, fname) == 0) {
-            if (prev) prev->next = cur->next;
-            else u->files = cur->next;
-            u->used_bytes -= cur->size;
-            free(cur);
-            return 0;
-        }
-        prev = cur; cur = cur->next;
-    }
-    return -1;
-}
+typedef enum { TASK_UPLOAD=1, TASK_DOWNLOAD=2, TASK_DELETE=3, TASK_LIST=4, TASK_REPLY=5, TASK_OFFER=6,
+               TASK_CHUNK=7, TASK_COMMIT=8 } task_type_t;
 
-typedef enum { TASK_UPLOAD=1, TASK_DOWNLOAD=2, TASK_DELETE=3, TASK_LIST=4 } task_type_t;
+typedef struct Conn Conn;
 
 typedef struct Task {
-    int client_sock;
-    int session_id;
+    Conn *conn;
+    uint64_t seq;
     char username[MAX_USERNAME];
     task_type_t type;
     char filename[MAX_FILENAME];
     size_t filesize;
+    unsigned char digest[SHA256_LEN];
+    char tmppath[192];
+    uint64_t sess_id;
+    UpSession *session; size_t chunk_off;
     char *outbuf; size_t outlen;
+    int body_fd; off_t body_off; size_t body_len;
+    FileLock *body_lock;
     int result_code;
     char errmsg[256];
+    size_t sent;
+    int at_head;
+    User *list_user; size_t list_left; int list_more;
+    struct Task *next;
 } Task;
 
-typedef struct Result {
-    int client_sock;
-    int session_id;
-    char *data; size_t len;
-} Result;
-
-static GenQueue client_q;
-static GenQueue task_q;
-static GenQueue result_q;
+static Queue client_q;
+static Queue task_q;
+static Queue result_q;
 
-static volatile int running = 1;
 static int listenfd = -1;
 
 static void send_error_task(Task *t, const char *err) {
@@ -267,186 +167,250 @@ static void make_paths(const char *user, const char *fname, char *outpath, size_
     snprintf(outpath, outlen, "storage/%s/%s", user, fname);
 }
 
-static void handle_upload(Task *t) {
-    char userdir[PATH_MAX], tmp_template[PATH_MAX], final[PATH_MAX];
-    snprintf(userdir, sizeof(userdir), "storage/%s", t->username);
-    int n = snprintf(tmp_template, sizeof(tmp_template), "%s/.tmp_%lu_XXXXXX", userdir, (unsigned long)pthread_self());
-    if (n < 0 || (size_t)n >= sizeof(tmp_template)) {
-        send_error_task(t, "ERR path_overflow\n");
-        return;
-    }
-
-    pthread_rwlock_t *fl = get_file_lock(t->username, t->filename);
-    if (!fl) { send_error_task(t, "ERR lock_fail\n"); return; }
-    pthread_rwlock_wrlock(fl);
+/* Drops a staged upload that will not be committed. */
+static void discard_staged(Task *t, int in_store) {
+    unlink(t->tmppath);
+    if (in_store) blob_release(t->digest);
+}
 
-    int tmpfd = mkstemp(tmp_template);
-    if (tmpfd < 0) {
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
-        send_error_task(t, "ERR cannot_create_tmp\n");
+/* Moves the file staged at t->tmppath into place as t->filename: quota
+ * check, rename and metadata update. in_store says the staged file is a
+ * link to the blob for t->digest. A blob the old content leaves without
+ * references is removed. Called with the file's write lock held. */
+static void commit_staged(Task *t, User *u, const char *final, int in_store) {
+    unsigned char old[SHA256_LEN];
+    int had_old = 0;
+    pthread_mutex_lock(&u->lock);
+    FileEntry *cur = find_user_file(u, t->filename);
+    size_t prev_size = cur ? cur->size : 0;
+    if (cur && file_has_digest(cur)) {
+        memcpy(old, cur->digest, SHA256_LEN);
+        had_old = 1;
+    }
+    if (u->used_bytes - prev_size + t->filesize > u->quota_bytes) {
+        pthread_mutex_unlock(&u->lock);
+        discard_staged(t, in_store);
+        send_error_task(t, "ERR quota_exceeded\n");
         return;
     }
-    FILE *f = fdopen(tmpfd, "wb");
-    if (!f) {
-        close(tmpfd);
-        unlink(tmp_template);
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
-        send_error_task(t, "ERR cannot_create_tmp\n");
+    int same = had_old && in_store && memcmp(old, t->digest, SHA256_LEN) == 0;
+    /* rename() between two links to one inode is a no-op. */
+    if (same) unlink(t->tmppath);
+    else if (rename(t->tmppath, final) != 0) {
+        pthread_mutex_unlock(&u->lock);
+        discard_staged(t, in_store);
+        send_error_task(t, "ERR rename_failed\n");
         return;
     }
 
-    size_t left = t->filesize;
-    char buf[4096];
-    int read_ok = 1;
-    while (left) {
-        size_t toread = (left > sizeof(buf) ? sizeof(buf) : left);
-        ssize_t r = recv_all(t->client_sock, buf, toread);
-        if (r <= 0) { read_ok = 0; break; }
-        size_t w = fwrite(buf, 1, (size_t)r, f);
-        if (w != (size_t)r) { read_ok = 0; break; }
-        left -= (size_t)r;
-    }
-    fclose(f);
-    if (!read_ok) {
-        unlink(tmp_template);
-        send_error_task(t, "ERR upload_recv_failed\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
+    FileEntry *f = set_user_file(u, t->filename, t->filesize);
+    if (f && in_store) memcpy(f->digest, t->digest, SHA256_LEN);
+    meta_log_put(t->username, t->filename, t->filesize, in_store ? t->digest : NULL);
+    pthread_mutex_unlock(&u->lock);
+    if (had_old && !same) blob_release(old);
+
+    t->result_code = 1;
+    snprintf(t->errmsg, sizeof(t->errmsg), "OK\n");
+}
+
+/* Commit step of an UPLOAD whose payload the connection layer has already
+ * written to t->tmppath and hashed into t->digest: the payload joins the
+ * blob store, or is dropped for the blob already holding that content,
+ * and is then committed. The file's write lock is held only for this
+ * step. */
+static void handle_upload(Task *t) {
+    char final[PATH_MAX];
+    int rn = snprintf(final, sizeof(final), "storage/%s/%s", t->username, t->filename);
+    if (rn < 0 || (size_t)rn >= sizeof(final)) {
+        unlink(t->tmppath);
+        send_error_task(t, "ERR path_overflow\n");
         return;
     }
 
+    FileLock *fl = get_file_lock(t->username, t->filename);
+    if (!fl) { unlink(t->tmppath); send_error_task(t, "ERR lock_fail\n"); return; }
+    file_wrlock(fl);
+
     User *u = find_user(t->username);
     if (!u) {
-        unlink(tmp_template);
+        unlink(t->tmppath);
         send_error_task(t, "ERR user_not_found\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
-        return;
+    } else {
+        commit_staged(t, u, final, blob_adopt(t->tmppath, t->digest) == 0);
     }
+    file_unlock(fl);
+    release_file_lock(fl);
+}
 
-    pthread_mutex_lock(&u->lock);
-    FileEntry *cur = u->files;
-    size_t prev_size = 0;
-    while (cur) { if (strcmp(cur->name, t->filename) == 0) { prev_size = cur->size; break; } cur = cur->next; }
-    if (u->used_bytes - prev_size + t->filesize > u->quota_bytes) {
-        pthread_mutex_unlock(&u->lock);
-        unlink(tmp_template);
-        send_error_task(t, "ERR quota_exceeded\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
-        return;
+/* Stages a new link to the blob for t->digest at t->tmppath, provided
+ * the blob exists and has the offered size. */
+static int stage_offer(Task *t) {
+    int fd = mkostemp(t->tmppath, O_CLOEXEC);
+    if (fd < 0) { send_error_task(t, "ERR cannot_create_tmp\n"); return -1; }
+    close(fd);
+    if (blob_link(t->digest, t->tmppath) != 0) {
+        send_error_task(t, errno == ENOENT ? "ERR absent\n" : "ERR io\n");
+        unlink(t->tmppath);
+        return -1;
+    }
+    struct stat st;
+    if (stat(t->tmppath, &st) != 0 || (size_t)st.st_size != t->filesize) {
+        discard_staged(t, 1);
+        send_error_task(t, "ERR absent\n");
+        return -1;
     }
+    return 0;
+}
 
-    int rn = snprintf(final, sizeof(final), "%s/%s", userdir, t->filename);
-    if (rn < 0 || (size_t)rn >= sizeof(final)) {
-        pthread_mutex_unlock(&u->lock);
-        unlink(tmp_template);
+/* OFFER: stores t->filename as a new link to the blob for t->digest if
+ * the server already has that content, so the client can skip the
+ * UPLOAD. Otherwise answers ERR absent. */
+static void handle_offer(Task *t) {
+    char final[PATH_MAX];
+    int rn = snprintf(final, sizeof(final), "storage/%s/%s", t->username, t->filename);
+    int tn = snprintf(t->tmppath, sizeof(t->tmppath), "storage/%s/.tmp_offer_XXXXXX", t->username);
+    if (rn < 0 || (size_t)rn >= sizeof(final) || tn < 0 || (size_t)tn >= sizeof(t->tmppath)) {
         send_error_task(t, "ERR path_overflow\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
-        return;
-    }
-    if (rename(tmp_template, final) != 0) {
-        pthread_mutex_unlock(&u->lock);
-        unlink(tmp_template);
-        send_error_task(t, "ERR rename_failed\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
         return;
     }
 
-    cur = u->files;
-    while (cur) {
-        if (strcmp(cur->name, t->filename) == 0) { u->used_bytes = u->used_bytes - cur->size + t->filesize; cur->size = t->filesize; break; }
-        cur = cur->next;
+    FileLock *fl = get_file_lock(t->username, t->filename);
+    if (!fl) { send_error_task(t, "ERR lock_fail\n"); return; }
+    file_wrlock(fl);
+
+    User *u = find_user(t->username);
+    if (!u) send_error_task(t, "ERR user_not_found\n");
+    else if (stage_offer(t) == 0) commit_staged(t, u, final, 1);
+    file_unlock(fl);
+    release_file_lock(fl);
+}
+
+static int hash_file(const char *path, unsigned char digest[SHA256_LEN]) {
+    char buf[HASH_READ_BUF];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    Sha256 sha;
+    sha256_init(&sha);
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) { close(fd); return -1; }
+        if (n == 0) break;
+        sha256_update(&sha, buf, (size_t)n);
     }
-    if (!cur) add_file_to_user(u, t->filename, t->filesize);
-    pthread_mutex_unlock(&u->lock);
+    close(fd);
+    sha256_final(&sha, digest);
+    return 0;
+}
 
-    t->result_code = 1;
-    snprintf(t->errmsg, sizeof(t->errmsg), "OK\n");
-    pthread_rwlock_unlock(fl);
-    release_file_lock(t->username, t->filename);
+/* UPCOMMIT: once every byte of the session has arrived, its staging file
+ * is hashed and committed exactly like an UPLOAD's temp file. */
+static void handle_commit(Task *t) {
+    const char *err;
+    UpSession *s = upsess_detach(t->sess_id, 1, &err);
+    if (!s) { send_error_task(t, err); return; }
+    snprintf(t->username, sizeof(t->username), "%s", upsess_user(s));
+    snprintf(t->filename, sizeof(t->filename), "%s", upsess_file(s));
+    snprintf(t->tmppath, sizeof(t->tmppath), "%s", upsess_path(s));
+    t->filesize = upsess_size(s);
+    upsess_free(s, 0);
+    if (hash_file(t->tmppath, t->digest) != 0) {
+        unlink(t->tmppath);
+        send_error_task(t, "ERR io\n");
+        return;
+    }
+    handle_upload(t);
 }
 
+/* Replies with the "OK <size>" header in errmsg and leaves the open file
+ * and its read lock in the task; the sender streams the body with
+ * sendfile() and only then drops the lock. */
 static void handle_download(Task *t) {
-    pthread_rwlock_t *fl = get_file_lock(t->username, t->filename);
+    FileLock *fl = get_file_lock(t->username, t->filename);
     if (!fl) { send_error_task(t, "ERR lock_fail\n"); return; }
-    pthread_rwlock_rdlock(fl);
+    file_rdlock(fl);
 
     char path[PATH_MAX];
     make_paths(t->username, t->filename, path, sizeof(path));
-    FILE *f = fopen(path, "rb");
-    if (!f) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         send_error_task(t, "ERR not_found\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
+        file_unlock(fl);
+        release_file_lock(fl);
         return;
     }
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); send_error_task(t, "ERR io\n"); pthread_rwlock_unlock(fl); release_file_lock(t->username, t->filename); return; }
-    long ft = ftell(f);
-    if (ft < 0) { fclose(f); send_error_task(t, "ERR io\n"); pthread_rwlock_unlock(fl); release_file_lock(t->username, t->filename); return; }
-    size_t sz = (size_t)ft;
-    if (fseek(f, 0, SEEK_SET) != 0) { fclose(f); send_error_task(t, "ERR io\n"); pthread_rwlock_unlock(fl); release_file_lock(t->username, t->filename); return; }
-
-    char header[128];
-    int hn = snprintf(header, sizeof(header), "OK %zu\n", sz);
-    if (hn < 0) { fclose(f); send_error_task(t, "ERR mem\n"); pthread_rwlock_unlock(fl); release_file_lock(t->username, t->filename); return; }
-    size_t tot = (size_t)hn + sz;
-    char *buf = malloc(tot);
-    if (!buf) { fclose(f); send_error_task(t, "ERR mem\n"); pthread_rwlock_unlock(fl); release_file_lock(t->username, t->filename); return; }
-    memcpy(buf, header, (size_t)hn);
-    size_t off = (size_t)hn;
-    size_t left = sz;
-    char tmpbuf[4096];
-    while (left) {
-        size_t r = fread(tmpbuf, 1, (left > sizeof(tmpbuf) ? sizeof(tmpbuf) : left), f);
-        if (r == 0) break;
-        memcpy(buf + off, tmpbuf, r);
-        off += r;
-        left -= r;
-    }
-    fclose(f);
-    t->outbuf = buf; t->outlen = tot;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); send_error_task(t, "ERR io\n"); file_unlock(fl); release_file_lock(fl); return; }
+    size_t sz = (size_t)st.st_size;
+
+    snprintf(t->errmsg, sizeof(t->errmsg), "OK %zu\n", sz);
+    t->body_fd = fd; t->body_off = 0; t->body_len = sz;
+    t->body_lock = fl;
     t->result_code = 1;
-    pthread_rwlock_unlock(fl);
-    release_file_lock(t->username, t->filename);
 }
 
 static void handle_delete(Task *t) {
-    pthread_rwlock_t *fl = get_file_lock(t->username, t->filename);
+    FileLock *fl = get_file_lock(t->username, t->filename);
     if (!fl) { send_error_task(t, "ERR lock_fail\n"); return; }
-    pthread_rwlock_wrlock(fl);
+    file_wrlock(fl);
 
     User *u = find_user(t->username);
     if (!u) {
         send_error_task(t, "ERR user_not_found\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
+        file_unlock(fl);
+        release_file_lock(fl);
         return;
     }
     pthread_mutex_lock(&u->lock);
-    FileEntry *cur = u->files;
-    size_t fsize = 0;
-    while (cur) { if (strcmp(cur->name, t->filename) == 0) { fsize = cur->size; break; } cur = cur->next; }
-    if (fsize == 0) {
+    FileEntry *f = find_user_file(u, t->filename);
+    if (!f) {
         pthread_mutex_unlock(&u->lock);
         send_error_task(t, "ERR not_found\n");
-        pthread_rwlock_unlock(fl);
-        release_file_lock(t->username, t->filename);
+        file_unlock(fl);
+        release_file_lock(fl);
         return;
     }
+    int in_store = file_has_digest(f);
+    if (in_store) memcpy(t->digest, f->digest, SHA256_LEN);
     remove_file_from_user(u, t->filename);
+    meta_log_del(t->username, t->filename);
     pthread_mutex_unlock(&u->lock);
     char path[PATH_MAX];
     make_paths(t->username, t->filename, path, sizeof(path));
     unlink(path);
+    if (in_store) blob_release(t->digest);
     t->result_code = 1;
     snprintf(t->errmsg, sizeof(t->errmsg), "OK\n");
-    pthread_rwlock_unlock(fl);
-    release_file_lock(t->username, t->filename);
+    file_unlock(fl);
+    release_file_lock(fl);
+}
+
+/* Fills t->outbuf with the next page of a listing: files sorting after
+ * the cursor in t->filename, then END once there are none left, or MORE
+ * <cursor> once the LIST limit runs out first. u->lock is held only while
+ * one page is copied, so a large listing is streamed page by page as the
+ * socket drains instead of being built whole. */
+static void list_fill_page(Task *t) {
+    User *u = t->list_user;
+    size_t off = 0;
+    pthread_mutex_lock(&u->lock);
+    FileEntry *f = next_user_file(u, t->filename[0] ? t->filename : NULL);
+    while (f && t->list_left && off + LIST_LINE_MAX <= LIST_PAGE_BYTES) {
+        off += snprintf(t->outbuf + off, LIST_PAGE_BYTES - off, "%s %zu\n", f->name, f->size);
+        snprintf(t->filename, sizeof(t->filename), "%s", f->name);
+        t->list_left--;
+        f = next_user_file(u, f->name);
+    }
+    pthread_mutex_unlock(&u->lock);
+    if (!f) {
+        off += snprintf(t->outbuf + off, LIST_PAGE_BYTES - off, "END\n");
+        t->list_more = 0;
+    } else if (!t->list_left) {
+        off += snprintf(t->outbuf + off, LIST_PAGE_BYTES - off, "MORE %s\n", t->filename);
+        t->list_more = 0;
+    }
+    t->outlen = off;
 }
 
 static void handle_list(Task *t) {
@@ -455,64 +419,260 @@ static void handle_list(Task *t) {
         send_error_task(t, "ERR user_not_found\n");
         return;
     }
-    pthread_mutex_lock(&u->lock);
-    size_t need = 0;
-    FileEntry *f = u->files;
-    char line[512];
-    while (f) {
-        int n = snprintf(line, sizeof(line), "%s %zu\n", f->name, f->size);
-        need += (n>0?n:0);
-        f = f->next;
-    }
-    need += 5;
-    char *buf = malloc(need+1);
-    if (!buf) { pthread_mutex_unlock(&u->lock); send_error_task(t, "ERR mem\n"); return; }
-    size_t off = 0;
-    f = u->files;
-    while (f) {
-        int n = snprintf(line, sizeof(line), "%s %zu\n", f->name, f->size);
-        memcpy(buf + off, line, n); off += n;
-        f = f->next;
-    }
-    memcpy(buf + off, "END\n", 4); off += 4;
-    buf[off] = '\0';
-    pthread_mutex_unlock(&u->lock);
-    t->outbuf = buf; t->outlen = off;
+    t->list_user = u;
+    t->list_more = 1;
+    list_fill_page(t);
     t->result_code = 1;
 }
 
+static void task_q_room(void);
+
 static void *worker_thread_fn(void *arg) {
     (void)arg;
     while (running) {
         Task *t = (Task *)queue_pop(&task_q);
         if (!t) break;
+        task_q_room();
         if (t->type == TASK_UPLOAD) handle_upload(t);
         else if (t->type == TASK_DOWNLOAD) handle_download(t);
         else if (t->type == TASK_DELETE) handle_delete(t);
         else if (t->type == TASK_LIST) handle_list(t);
+        else if (t->type == TASK_OFFER) handle_offer(t);
+        else if (t->type == TASK_COMMIT) handle_commit(t);
         else { send_error_task(t, "ERR unknown_task\n"); }
         queue_push(&result_q, t);
     }
     return NULL;
 }
 
+/*
+ * Tasks and I/O buffers (receive buffers and LIST pages) come from the
+ * reactor's pools and are only ever allocated and freed on the reactor
+ * thread: workers and senders hand finished tasks back on the done stack.
+ *
+ * Tasks only enter task_q through a non-blocking push. One that does not
+ * fit waits on its reactor's pend list, and its connection stops reading
+ * until it is in, so a flood of commands backs up into the client's
+ * socket instead of into server memory. want_room asks the workers to
+ * wake the reactor once they have taken something off task_q. Written
+ * tasks come back on the lock-free done stack.
+ */
+typedef struct Reactor {
+    int epfd;
+    int wakefd;
+    Task *_Atomic done;
+    pthread_mutex_t pend_m;
+    Task *pend, **pend_tail;
+    _Atomic int want_room;
+    Pool tasks;
+    Pool bufs;
+    Conn *ready;
+    char *upbuf;
+    pthread_t thread;
+} Reactor;
+
+/*
+ * Responses leave a connection strictly in request order: every Task gets
+ * the connection's next sequence number when its line is parsed, finished
+ * tasks wait in `done` (sorted by seq) until all earlier ones have been
+ * written, and only one thread writes to the socket at a time. Writes never
+ * block; when the socket is full the rest is sent by the reactor on
+ * EPOLLOUT, so a slow reader holds no sender thread.
+ *
+ * A DOWNLOAD keeps its file's read lock until the body is sent, so it must
+ * not take it while still waiting behind earlier responses: one of those
+ * could be an UPLOAD of the same file that needs the write lock. Such a
+ * task is marked at_head and only goes to the workers once it reaches the
+ * front of the line; it also sees every earlier command's effects.
+ */
+struct Conn {
+    int fd;
+    int session_id;
+    Reactor *r;
+    RecvBuf in;
+    char line[LINEBUF];
+    Task *upload;
+    int up_fd;
+    off_t up_off;
+    size_t up_left;
+    Sha256 up_sha;
+    uint64_t next_seq;
+    int inflight;
+    int broken;
+    int deferred;
+    int resume;
+    _Atomic int stalled;
+    Conn *next_ready;
+
+    pthread_mutex_t out_m;
+    Task *done;
+    Task *writing;
+    uint64_t send_seq;
+    int flushing;
+    int blocked;
+    int out_dead;
+    int closing;
+    int unwatched;
+    uint32_t events;
+};
+
+static Reactor reactors[REACTOR_POOL_SIZE];
+static Conn **conn_table;
+static size_t conn_table_size;
+
+static void reactor_wake(Reactor *r) {
+    uint64_t one = 1;
+    if (write(r->wakefd, &one, sizeof(one)) < 0) { }
+}
+
+/* Hands t to the workers, or parks it on the reactor and stalls its
+ * connection when task_q is full. Never blocks, so it is safe from the
+ * reactor and from a sender holding out_m. */
+static void submit_task(Task *t) {
+    if (queue_trypush(&task_q, t) == 0) return;
+    Conn *c = t->conn;
+    Reactor *r = c->r;
+    pthread_mutex_lock(&r->pend_m);
+    t->next = NULL;
+    *r->pend_tail = t;
+    r->pend_tail = &t->next;
+    atomic_fetch_add(&c->stalled, 1);
+    pthread_mutex_unlock(&r->pend_m);
+    reactor_wake(r);
+}
+
+static void task_q_room(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) {
+        Reactor *r = &reactors[i];
+        if (atomic_load_explicit(&r->want_room, memory_order_relaxed) && atomic_exchange(&r->want_room, 0))
+            reactor_wake(r);
+    }
+}
+
+static void task_release_body(Task *t) {
+    if (t->body_fd >= 0) close(t->body_fd);
+    t->body_fd = -1;
+    if (t->body_lock) {
+        file_unlock(t->body_lock);
+        release_file_lock(t->body_lock);
+        t->body_lock = NULL;
+    }
+}
+
+/* Reactor thread only. */
+static void task_free(Reactor *r, Task *t) {
+    pool_put(&r->bufs, t->outbuf);
+    pool_put(&r->tasks, t);
+}
+
+/* Writes as much of t's response as the socket accepts. Returns 1 once it
+ * is fully sent, 0 if the socket is full, -1 on error. */
+static int task_write(int sock, Task *t) {
+    const char *hdr = t->errmsg;
+    size_t hlen = strlen(t->errmsg);
+    int body = t->result_code != -1 && t->body_fd >= 0;
+    if (t->result_code != -1 && t->outbuf) { hdr = t->outbuf; hlen = t->outlen; }
+    for (;;) {
+        while (t->sent < hlen) {
+            ssize_t s = send(sock, hdr + t->sent, hlen - t->sent, MSG_NOSIGNAL | (body ? MSG_MORE : 0));
+            if (s < 0 && errno == EINTR) continue;
+            if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            if (s <= 0) return -1;
+            t->sent += (size_t)s;
+        }
+        if (t->result_code == -1 || !t->list_more) break;
+        list_fill_page(t);
+        hdr = t->outbuf; hlen = t->outlen;
+        t->sent = 0;
+    }
+    while (body && t->body_len) {
+        ssize_t s = sendfile(sock, t->body_fd, &t->body_off, t->body_len > SENDFILE_CHUNK ? SENDFILE_CHUNK : t->body_len);
+        if (s < 0 && errno == EINTR) continue;
+        if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (s <= 0) return -1;
+        t->body_len -= (size_t)s;
+    }
+    return 1;
+}
+
+/* Called with c->out_m held. */
+static void conn_update_events(Conn *c) {
+    if (c->unwatched) return;
+    int reading = !c->closing && !atomic_load(&c->stalled);
+    uint32_t want = (reading ? EPOLLIN : 0) | (c->blocked ? EPOLLOUT : 0);
+    if (want == c->events) return;
+    struct epoll_event ev = { .events = want, .data.ptr = c };
+    if (epoll_ctl(c->r->epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0) c->events = want;
+}
+
+/* Writes finished responses in sequence order until the next one is not
+ * ready yet or the socket is full. t, if given, is a newly finished task
+ * to queue first; from_poll is set when the reactor saw the socket become
+ * writable again. Written tasks go back to the reactor, which owns the
+ * Conn's lifetime, only after this thread is done touching the Conn. */
+static void conn_flush(Conn *c, Task *t, int from_poll) {
+    Reactor *r = c->r;
+    Task *retired = NULL, **rtail = &retired;
+    pthread_mutex_lock(&c->out_m);
+    if (t) {
+        Task **pp = &c->done;
+        while (*pp && (*pp)->seq < t->seq) pp = &(*pp)->next;
+        t->next = *pp;
+        *pp = t;
+    }
+    if (c->flushing || (c->blocked && !from_poll)) {
+        pthread_mutex_unlock(&c->out_m);
+        return;
+    }
+    c->flushing = 1;
+    c->blocked = 0;
+    for (;;) {
+        t = c->writing;
+        if (!t && c->done && c->done->seq == c->send_seq) {
+            t = c->done;
+            c->done = t->next;
+            if (t->at_head) {
+                t->at_head = 0;
+                submit_task(t);
+                break;
+            }
+            c->writing = t;
+        }
+        if (!t) break;
+        int dead = c->out_dead;
+        pthread_mutex_unlock(&c->out_m);
+        int rc = dead ? -1 : task_write(c->fd, t);
+        pthread_mutex_lock(&c->out_m);
+        if (rc == 0) { c->blocked = 1; break; }
+        if (rc < 0) c->out_dead = 1;
+        c->writing = NULL;
+        c->send_seq++;
+        task_release_body(t);
+        t->next = NULL;
+        *rtail = t;
+        rtail = &t->next;
+    }
+    c->flushing = 0;
+    conn_update_events(c);
+    pthread_mutex_unlock(&c->out_m);
+    if (!retired) return;
+    Task *old = atomic_load(&r->done);
+    do *rtail = old;
+    while (!atomic_compare_exchange_weak(&r->done, &old, retired));
+    reactor_wake(r);
+}
+
+static void conn_complete(Task *t) {
+    conn_flush(t->conn, t, 0);
+}
+
 static void *sender_thread_fn(void *arg) {
     (void)arg;
     while (running) {
         Task *t = (Task *)queue_pop(&result_q);
         if (!t) break;
-        if (t->result_code == -1) {
-            send_all(t->client_sock, t->errmsg, strlen(t->errmsg));
-        } else {
-            if (t->outbuf) {
-                if (send_all(t->client_sock, t->outbuf, t->outlen) < 0) {
-                }
-                free(t->outbuf);
-            } else {
-                send_all(t->client_sock, t->errmsg, strlen(t->errmsg));
-            }
-        }
-        free(t);
+        conn_complete(t);
     }
     return NULL;
 }
@@ -524,111 +684,510 @@ static int next_session_id() {
     pthread_mutex_lock(&sid_m); int v = sid++; pthread_mutex_unlock(&sid_m); return v;
 }
 
-static void *client_thread_fn(void *arg) {
-    (void)arg;
-    char line[LINEBUF];
-    while (running) {
-        int sock = (int)(intptr_t)queue_pop(&client_q);
-        if (!running || sock == 0) { if (sock) close(sock); break; }
-        int session = next_session_id();
-        while (1) {
-            ssize_t n = recv_line(sock, line, sizeof(line));
-            if (n <= 0) { close(sock); break; }
-            char cmd[32], username[MAX_USERNAME];
-            if (sscanf(line, "%31s %63s", cmd, username) >= 1) {
-                if (strcmp(cmd, "SIGNUP") == 0) {
-                    if (sscanf(line, "%*s %63s", username) != 1) { send_all(sock, "ERR invalid_signup\n", 19); continue; }
-                    if (create_user(username) != 0) {
-                        send_all(sock, "ERR user_exists\n", 16);
-                    } else {
-                        send_all(sock, "OK\n", 3);
-                    }
-                    continue;
-                } else if (strcmp(cmd, "LOGIN") == 0) {
-                    if (sscanf(line, "%*s %63s", username) != 1) { send_all(sock, "ERR invalid_login\n", 18); continue; }
-                    if (!find_user(username)) send_all(sock, "ERR no_such_user\n", 17);
-                    else send_all(sock, "OK\n", 3);
-                    continue;
-                }
-            }
+/*
+ * Connection layer: each reactor thread owns a set of non-blocking client
+ * sockets in its epoll set. It assembles command lines as bytes arrive and
+ * turns them into Tasks on task_q; an idle connection costs a Conn and a file
+ * descriptor, not a thread. UPLOAD payloads are received here as well, into
+ * a temp file, so a slow client never holds a worker. A socket is only
+ * closed once every task queued for it has been sent, so its fd cannot be
+ * reused under a worker or sender.
+ */
+
+/* Queues a connection whose buffer may still hold complete lines, since
+ * epoll will not report it again until more bytes reach the socket. */
+static void reactor_defer(Conn *c) {
+    if (c->deferred) return;
+    c->deferred = 1;
+    c->next_ready = c->r->ready;
+    c->r->ready = c;
+}
+
+static void conn_open(Reactor *r, int fd) {
+    if ((size_t)fd >= conn_table_size) { close(fd); return; }
+    Conn *c = calloc(1, sizeof(Conn));
+    if (!c) { close(fd); return; }
+    c->fd = fd;
+    c->r = r;
+    c->session_id = next_session_id();
+    rbuf_init(&c->in, fd, &r->bufs);
+    c->up_fd = -1;
+    pthread_mutex_init(&c->out_m, NULL);
+    c->events = EPOLLIN;
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        pthread_mutex_destroy(&c->out_m);
+        close(fd);
+        free(c);
+        return;
+    }
+    conn_table[fd] = c;
+}
+static void conn_free(Conn *c) {
+    if (c->deferred) {
+        Conn **pp = &c->r->ready;
+        while (*pp != c) pp = &(*pp)->next_ready;
+        *pp = c->next_ready;
+    }
+    if (c->upload) {
+        Task *t = c->upload;
+        if (c->up_fd >= 0) close(c->up_fd);
+        if (t->type == TASK_UPLOAD) unlink(t->tmppath);
+        else if (t->session) upsess_end_chunk(t->session, t->chunk_off, t->filesize, 0);
+        task_free(c->r, t);
+    }
+    if (c->writing) c->writing->next = c->done;
+    else c->writing = c->done;
+    while (c->writing) {
+        Task *t = c->writing;
+        c->writing = t->next;
+        task_release_body(t);
+        task_free(c->r, t);
+    }
+    conn_table[c->fd] = NULL;
+    close(c->fd);
+    rbuf_destroy(&c->in);
+    pthread_mutex_destroy(&c->out_m);
+    free(c);
+}
+/* The peer is gone or the input is unusable: stop reading, keep writing
+ * whatever is still owed, and close once nothing is in flight. */
+static void conn_hangup(Conn *c) {
+    pthread_mutex_lock(&c->out_m);
+    c->closing = 1;
+    conn_update_events(c);
+    pthread_mutex_unlock(&c->out_m);
+    if (!c->inflight) conn_free(c);
+}
+
+static Task *conn_new_task(Conn *c, task_type_t type, const char *uname, const char *fname) {
+    Task *t = pool_get(&c->r->tasks);
+    if (!t) return NULL;
+    memset(t, 0, sizeof(Task));
+    t->conn = c;
+    t->seq = c->next_seq++;
+    if (uname) strncpy(t->username, uname, sizeof(t->username)-1);
+    t->type = type;
+    if (fname) strncpy(t->filename, fname, sizeof(t->filename)-1);
+    t->outbuf = NULL; t->outlen = 0;
+    t->body_fd = -1;
+    t->result_code = 0;
+    t->errmsg[0] = '\0';
+    c->inflight++;
+    return t;
+}
+/* Answers a command the reactor handles itself, in sequence with the
+ * responses still owed for earlier commands. */
+static void conn_reply(Conn *c, const char *msg) {
+    Task *t = conn_new_task(c, TASK_REPLY, NULL, NULL);
+    if (!t) { c->broken = 1; return; }
+    t->result_code = 1;
+    snprintf(t->errmsg, sizeof(t->errmsg), "%s", msg);
+    conn_complete(t);
+}
+
+/* Starts receiving an UPLOAD payload into a preallocated temp file in the
+ * user's directory. If that cannot be set up the payload is still read and
+ * discarded, so the command stream stays in sync. */
+static void conn_begin_upload(Conn *c, Task *t) {
+    c->upload = t;
+    c->up_left = t->filesize;
+    c->up_off = 0;
+    c->up_fd = -1;
+    sha256_init(&c->up_sha);
+    int n = snprintf(t->tmppath, sizeof(t->tmppath), "storage/%s/.tmp_%d_XXXXXX", t->username, c->session_id);
+    if (n < 0 || (size_t)n >= sizeof(t->tmppath)) {
+        send_error_task(t, "ERR path_overflow\n");
+        return;
+    }
+    c->up_fd = mkostemp(t->tmppath, O_CLOEXEC);
+    if (c->up_fd < 0) {
+        send_error_task(t, "ERR cannot_create_tmp\n");
+        return;
+    }
+    if (t->filesize && fallocate(c->up_fd, 0, 0, (off_t)t->filesize) != 0 && errno == ENOSPC) {
+        close(c->up_fd);
+        c->up_fd = -1;
+        unlink(t->tmppath);
+        send_error_task(t, "ERR no_space\n");
+    }
+}
+/* Starts receiving an UPCHUNK payload straight into its session's
+ * staging file at the chunk's offset. As with UPLOAD, the payload is
+ * still read and discarded if the chunk is refused. */
+static void conn_begin_chunk(Conn *c, Task *t) {
+    const char *err;
+    c->upload = t;
+    c->up_left = t->filesize;
+    c->up_off = (off_t)t->chunk_off;
+    c->up_fd = -1;
+    t->session = upsess_begin_chunk(t->sess_id, t->chunk_off, t->filesize, &c->up_fd, &err);
+    if (!t->session) send_error_task(t, err);
+}
+static void conn_upload_write(Conn *c, const char *p, size_t n) {
+    if (c->up_fd >= 0 && c->upload->type == TASK_UPLOAD) sha256_update(&c->up_sha, p, n);
+    while (n && c->up_fd >= 0) {
+        ssize_t w = pwrite(c->up_fd, p, n, c->up_off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            close(c->up_fd);
+            c->up_fd = -1;
+            if (c->upload->type == TASK_UPLOAD) unlink(c->upload->tmppath);
+            send_error_task(c->upload, "ERR upload_write_failed\n");
+            return;
+        }
+        p += w;
+        n -= (size_t)w;
+        c->up_off += w;
+    }
+}
+static void conn_finish_upload(Conn *c) {
+    Task *t = c->upload;
+    c->upload = NULL;
+    if (c->up_fd >= 0) {
+        close(c->up_fd);
+        c->up_fd = -1;
+        if (t->type == TASK_UPLOAD) sha256_final(&c->up_sha, t->digest);
+    }
+    if (t->type == TASK_CHUNK) {
+        if (t->session) upsess_end_chunk(t->session, t->chunk_off, t->filesize, t->result_code != -1);
+        t->session = NULL;
+        if (t->result_code != -1) {
+            t->result_code = 1;
+            snprintf(t->errmsg, sizeof(t->errmsg), "OK\n");
+        }
+        conn_complete(t);
+    } else if (t->result_code == -1) {
+        conn_complete(t);
+    } else {
+        submit_task(t);
+    }
+}
+/* Moves payload bytes from the input buffer, then from the socket in
+ * UPLOAD_CHUNK reads, into the temp file. Returns 1 once the payload is
+ * complete, 0 if it has to wait for the socket, -1 on EOF or error. */
+static int conn_recv_upload(Conn *c) {
+    int reads = 0;
+    while (c->up_left) {
+        size_t avail = c->in.end - c->in.start;
+        if (avail) {
+            size_t n = avail < c->up_left ? avail : c->up_left;
+            conn_upload_write(c, c->in.data + c->in.start, n);
+            c->in.start += n;
+            c->up_left -= n;
+            continue;
+        }
+        if (reads++ == UPLOAD_READS_PER_EVENT) { reactor_defer(c); return 0; }
+        size_t want = c->up_left < UPLOAD_CHUNK ? c->up_left : UPLOAD_CHUNK;
+        ssize_t r = recv(c->fd, c->r->upbuf, want, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (r <= 0) return -1;
+        conn_upload_write(c, c->r->upbuf, (size_t)r);
+        c->up_left -= (size_t)r;
+    }
+    conn_finish_upload(c);
+    return 1;
+}
+
+/* UPBEGIN: checks the user and quota up front, then opens a session.
+ * Returns the reply, formatted into buf on success. */
+static const char *upload_begin(const char *uname, const char *fname, size_t fsize, char *buf, size_t len) {
+    User *u = find_user(uname);
+    if (!u) return "ERR user_not_found\n";
+    pthread_mutex_lock(&u->lock);
+    FileEntry *cur = find_user_file(u, fname);
+    int over = u->used_bytes - (cur ? cur->size : 0) + fsize > u->quota_bytes;
+    pthread_mutex_unlock(&u->lock);
+    if (over) return "ERR quota_exceeded\n";
+    uint64_t id;
+    if (!upsess_create(uname, fname, fsize, &id)) return errno == ENOSPC ? "ERR no_space\n" : "ERR cannot_create_tmp\n";
+    snprintf(buf, len, "OK %016" PRIx64 "\n", id);
+    return buf;
+}
 
-            char first[128];
-            if (sscanf(line, "%127s", first) != 1) { send_all(sock, "ERR unknown\n", 12); continue; }
-            if (strcmp(first, "UPLOAD") == 0) {
-                char uname[MAX_USERNAME], fname[MAX_FILENAME]; size_t fsize;
-                if (sscanf(line, "UPLOAD %63s %255s %zu", uname, fname, &fsize) != 3) {
-                    send_all(sock, "ERR bad_upload_syntax\n", 22); continue;
-                }
-                Task *t = calloc(1, sizeof(Task));
-                if (!t) { send_all(sock, "ERR mem\n", 8); continue; }
-                t->client_sock = sock;
-                t->session_id = session;
-                strncpy(t->username, uname, sizeof(t->username)-1);
-                t->type = TASK_UPLOAD;
-                strncpy(t->filename, fname, sizeof(t->filename)-1);
-                t->filesize = fsize;
-                t->outbuf = NULL; t->outlen = 0;
-                t->result_code = 0;
-                t->errmsg[0] = '\0';
-                queue_push(&task_q, t);
-                continue;
-            } else if (strcmp(first, "DOWNLOAD") == 0) {
-                char uname[MAX_USERNAME], fname[MAX_FILENAME];
-                if (sscanf(line, "DOWNLOAD %63s %255s", uname, fname) != 2) {
-                    send_all(sock, "ERR bad_download_syntax\n", 24); continue;
-                }
-                Task *t = calloc(1, sizeof(Task));
-                if (!t) { send_all(sock, "ERR mem\n", 8); continue; }
-                t->client_sock = sock;
-                t->session_id = session;
-                strncpy(t->username, uname, sizeof(t->username)-1);
-                t->type = TASK_DOWNLOAD;
-                strncpy(t->filename, fname, sizeof(t->filename)-1);
-                t->outbuf = NULL; t->outlen = 0;
-                t->result_code = 0;
-                t->errmsg[0] = '\0';
-                queue_push(&task_q, t);
-                continue;
-            } else if (strcmp(first, "DELETE") == 0) {
-                char uname[MAX_USERNAME], fname[MAX_FILENAME];
-                if (sscanf(line, "DELETE %63s %255s", uname, fname) != 2) {
-                    send_all(sock, "ERR bad_delete_syntax\n", 22); continue;
-                }
-                Task *t = calloc(1, sizeof(Task));
-                if (!t) { send_all(sock, "ERR mem\n", 8); continue; }
-                t->client_sock = sock;
-                t->session_id = session;
-                strncpy(t->username, uname, sizeof(t->username)-1);
-                t->type = TASK_DELETE;
-                strncpy(t->filename, fname, sizeof(t->filename)-1);
-                t->outbuf = NULL; t->outlen = 0;
-                t->result_code = 0;
-                t->errmsg[0] = '\0';
-                queue_push(&task_q, t);
-                continue;
-            } else if (strcmp(first, "LIST") == 0) {
-                char uname[MAX_USERNAME];
-                if (sscanf(line, "LIST %63s", uname) != 1) { send_all(sock, "ERR bad_list_syntax\n", 20); continue; }
-                Task *t = calloc(1, sizeof(Task));
-                if (!t) { send_all(sock, "ERR mem\n", 8); continue; }
-                t->client_sock = sock;
-                t->session_id = session;
-                strncpy(t->username, uname, sizeof(t->username)-1);
-                t->type = TASK_LIST;
-                t->outbuf = NULL; t->outlen = 0;
-                t->result_code = 0;
-                t->errmsg[0] = '\0';
-                queue_push(&task_q, t);
-                continue;
+static void conn_dispatch_line(Conn *c, const char *line) {
+    char cmd[32], username[MAX_USERNAME];
+    if (sscanf(line, "%31s %63s", cmd, username) >= 1) {
+        if (strcmp(cmd, "SIGNUP") == 0) {
+            if (sscanf(line, "%*s %63s", username) != 1) { conn_reply(c, "ERR invalid_signup\n"); return; }
+            if (create_user(username) != 0) {
+                conn_reply(c, "ERR user_exists\n");
             } else {
-                send_all(sock, "ERR unknown_command\n", 20);
-                continue;
+                conn_reply(c, "OK\n");
             }
+            return;
+        } else if (strcmp(cmd, "LOGIN") == 0) {
+            if (sscanf(line, "%*s %63s", username) != 1) { conn_reply(c, "ERR invalid_login\n"); return; }
+            if (!find_user(username)) conn_reply(c, "ERR no_such_user\n");
+            else conn_reply(c, "OK\n");
+            return;
+        }
+    }
+
+    char first[128];
+    if (sscanf(line, "%127s", first) != 1) { conn_reply(c, "ERR unknown\n"); return; }
+    if (strcmp(first, "UPLOAD") == 0) {
+        char uname[MAX_USERNAME], fname[MAX_FILENAME]; size_t fsize;
+        if (sscanf(line, "UPLOAD %63s %255s %zu", uname, fname, &fsize) != 3) {
+            conn_reply(c, "ERR bad_upload_syntax\n"); return;
+        }
+        Task *t = conn_new_task(c, TASK_UPLOAD, uname, fname);
+        if (!t) { c->broken = 1; return; }
+        t->filesize = fsize;
+        conn_begin_upload(c, t);
+    } else if (strcmp(first, "DOWNLOAD") == 0) {
+        char uname[MAX_USERNAME], fname[MAX_FILENAME];
+        if (sscanf(line, "DOWNLOAD %63s %255s", uname, fname) != 2) {
+            conn_reply(c, "ERR bad_download_syntax\n"); return;
+        }
+        Task *t = conn_new_task(c, TASK_DOWNLOAD, uname, fname);
+        if (!t) { c->broken = 1; return; }
+        t->at_head = 1;
+        conn_complete(t);
+    } else if (strcmp(first, "DELETE") == 0) {
+        char uname[MAX_USERNAME], fname[MAX_FILENAME];
+        if (sscanf(line, "DELETE %63s %255s", uname, fname) != 2) {
+            conn_reply(c, "ERR bad_delete_syntax\n"); return;
+        }
+        Task *t = conn_new_task(c, TASK_DELETE, uname, fname);
+        if (!t) { c->broken = 1; return; }
+        submit_task(t);
+    } else if (strcmp(first, "OFFER") == 0) {
+        char uname[MAX_USERNAME], fname[MAX_FILENAME], hex[2 * SHA256_LEN + 2]; size_t fsize;
+        unsigned char digest[SHA256_LEN];
+        if (sscanf(line, "OFFER %63s %255s %zu %65s", uname, fname, &fsize, hex) != 4 ||
+            sha256_parse(hex, digest) != 0) {
+            conn_reply(c, "ERR bad_offer_syntax\n"); return;
+        }
+        Task *t = conn_new_task(c, TASK_OFFER, uname, fname);
+        if (!t) { c->broken = 1; return; }
+        t->filesize = fsize;
+        memcpy(t->digest, digest, SHA256_LEN);
+        submit_task(t);
+    } else if (strcmp(first, "UPBEGIN") == 0) {
+        char uname[MAX_USERNAME], fname[MAX_FILENAME], reply[64]; size_t fsize;
+        if (sscanf(line, "UPBEGIN %63s %255s %zu", uname, fname, &fsize) != 3) {
+            conn_reply(c, "ERR bad_upbegin_syntax\n"); return;
+        }
+        conn_reply(c, upload_begin(uname, fname, fsize, reply, sizeof(reply)));
+    } else if (strcmp(first, "UPCHUNK") == 0) {
+        uint64_t id; size_t off, len;
+        if (sscanf(line, "UPCHUNK %" SCNx64 " %zu %zu", &id, &off, &len) != 3) {
+            conn_reply(c, "ERR bad_upchunk_syntax\n"); return;
+        }
+        Task *t = conn_new_task(c, TASK_CHUNK, NULL, NULL);
+        if (!t) { c->broken = 1; return; }
+        t->sess_id = id;
+        t->chunk_off = off;
+        t->filesize = len;
+        conn_begin_chunk(c, t);
+    } else if (strcmp(first, "UPSTATUS") == 0) {
+        uint64_t id;
+        if (sscanf(line, "UPSTATUS %" SCNx64, &id) != 1) { conn_reply(c, "ERR bad_upstatus_syntax\n"); return; }
+        Task *t = conn_new_task(c, TASK_REPLY, NULL, NULL);
+        if (!t) { c->broken = 1; return; }
+        t->outbuf = pool_get(&c->r->bufs);
+        if (t->outbuf) t->outlen = upsess_status(id, t->outbuf, LIST_PAGE_BYTES - 5);
+        if (!t->outbuf) send_error_task(t, "ERR mem\n");
+        else if (!t->outlen) send_error_task(t, "ERR no_session\n");
+        else {
+            t->outlen += snprintf(t->outbuf + t->outlen, 5, "END\n");
+            t->result_code = 1;
+        }
+        conn_complete(t);
+    } else if (strcmp(first, "UPCOMMIT") == 0) {
+        uint64_t id;
+        if (sscanf(line, "UPCOMMIT %" SCNx64, &id) != 1) { conn_reply(c, "ERR bad_upcommit_syntax\n"); return; }
+        Task *t = conn_new_task(c, TASK_COMMIT, NULL, NULL);
+        if (!t) { c->broken = 1; return; }
+        t->sess_id = id;
+        submit_task(t);
+    } else if (strcmp(first, "UPABORT") == 0) {
+        uint64_t id;
+        const char *err;
+        if (sscanf(line, "UPABORT %" SCNx64, &id) != 1) { conn_reply(c, "ERR bad_upabort_syntax\n"); return; }
+        UpSession *s = upsess_detach(id, 0, &err);
+        upsess_free(s, 1);
+        conn_reply(c, s ? "OK\n" : err);
+    } else if (strcmp(first, "LIST") == 0) {
+        char uname[MAX_USERNAME], cursor[MAX_FILENAME];
+        size_t limit = SIZE_MAX;
+        int n = sscanf(line, "LIST %63s %zu %255s", uname, &limit, cursor);
+        if (n < 1 || limit == 0) { conn_reply(c, "ERR bad_list_syntax\n"); return; }
+        Task *t = conn_new_task(c, TASK_LIST, uname, n == 3 ? cursor : NULL);
+        if (!t) { c->broken = 1; return; }
+        t->list_left = limit;
+        t->outbuf = pool_get(&c->r->bufs);
+        if (!t->outbuf) { send_error_task(t, "ERR mem\n"); conn_complete(t); return; }
+        submit_task(t);
+    } else {
+        conn_reply(c, "ERR unknown_command\n");
+    }
+}
+
+/* Syncs EPOLLIN with a change in c->stalled. */
+static void conn_sync_events(Conn *c) {
+    pthread_mutex_lock(&c->out_m);
+    conn_update_events(c);
+    pthread_mutex_unlock(&c->out_m);
+}
+
+static void conn_on_readable(Conn *c) {
+    int lines = 0;
+    if (c->resume) {
+        c->resume = 0;
+        conn_sync_events(c);
+    }
+    while (!c->closing) {
+        if (atomic_load(&c->stalled)) {
+            conn_sync_events(c);
+            return;
+        }
+        if (c->upload) {
+            int r = conn_recv_upload(c);
+            if (r == 0) return;
+            if (r < 0) { conn_hangup(c); return; }
+        }
+        if (lines == MAX_LINES_PER_EVENT) { reactor_defer(c); return; }
+        if (rbuf_getline(&c->in, c->line, sizeof(c->line))) {
+            conn_dispatch_line(c, c->line);
+            if (c->broken) { conn_hangup(c); return; }
+            lines++;
+            continue;
+        }
+        ssize_t r = rbuf_fill(&c->in);
+        if (r > 0) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        conn_hangup(c);
+        return;
+    }
+    rbuf_release(&c->in);
+}
+
+static void conn_on_event(Conn *c, uint32_t ev) {
+    if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) conn_flush(c, NULL, 1);
+    if (!c->closing) {
+        conn_on_readable(c);
+        return;
+    }
+    if (ev & (EPOLLERR | EPOLLHUP)) {
+        /* Nothing more can be delivered; drop what is owed and stop
+         * polling so the error is not reported over and over. */
+        pthread_mutex_lock(&c->out_m);
+        c->out_dead = 1;
+        if (!c->unwatched) epoll_ctl(c->r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        c->unwatched = 1;
+        pthread_mutex_unlock(&c->out_m);
+        conn_flush(c, NULL, 1);
+    }
+}
+
+static void conn_task_done(Task *t) {
+    Conn *c = t->conn;
+    c->inflight--;
+    task_free(c->r, t);
+    if (c->closing && !c->inflight) conn_free(c);
+}
+
+/* Moves parked tasks onto task_q while it has room. A connection whose
+ * last parked task got in is queued to resume reading. want_room is set
+ * before trying, so a worker that frees a slot afterwards wakes us. */
+static void reactor_retry_pending(Reactor *r) {
+    pthread_mutex_lock(&r->pend_m);
+    if (r->pend) {
+        atomic_store(&r->want_room, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+    while (r->pend) {
+        Task *t = r->pend;
+        Conn *c = t->conn;
+        Task *next = t->next;
+        if (queue_trypush(&task_q, t) != 0) break;
+        r->pend = next;
+        if (atomic_fetch_sub(&c->stalled, 1) == 1) {
+            c->resume = 1;
+            reactor_defer(c);
+        }
+    }
+    if (!r->pend) {
+        r->pend_tail = &r->pend;
+        atomic_store(&r->want_room, 0);
+    }
+    pthread_mutex_unlock(&r->pend_m);
+}
+
+static void reactor_drain(Reactor *r) {
+    uint64_t v;
+    if (read(r->wakefd, &v, sizeof(v)) < 0) { }
+    void *p;
+    while ((p = queue_trypop(&client_q))) conn_open(r, (int)(intptr_t)p);
+    reactor_retry_pending(r);
+    Task *t = atomic_exchange(&r->done, NULL);
+    while (t) {
+        Task *next = t->next;
+        conn_task_done(t);
+        t = next;
+    }
+}
+
+static void *reactor_thread_fn(void *arg) {
+    Reactor *r = arg;
+    struct epoll_event evs[MAX_EVENTS];
+    while (running) {
+        int n = epoll_wait(r->epfd, evs, MAX_EVENTS, r->ready ? 0 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        int woken = 0;
+        for (int i = 0; i < n; ++i) {
+            Conn *c = evs[i].data.ptr;
+            if (!c) woken = 1;
+            else conn_on_event(c, evs[i].events);
+        }
+        /* Completions may free a Conn, so handle them after this batch. */
+        if (woken) reactor_drain(r);
+        Conn *ready = r->ready;
+        r->ready = NULL;
+        while (ready) {
+            Conn *c = ready;
+            ready = c->next_ready;
+            c->deferred = 0;
+            conn_on_readable(c);
         }
     }
     return NULL;
 }
 
+static int reactor_init(Reactor *r) {
+    atomic_init(&r->done, NULL);
+    pthread_mutex_init(&r->pend_m, NULL);
+    r->pend = NULL;
+    r->pend_tail = &r->pend;
+    atomic_init(&r->want_room, 0);
+    pool_init(&r->tasks, sizeof(Task), TASK_SLAB);
+    pool_init(&r->bufs, RECVBUF_SIZE, BUF_SLAB);
+    r->upbuf = malloc(UPLOAD_CHUNK);
+    if (!r->upbuf) return -1;
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->epfd < 0 || r->wakefd < 0) return -1;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    return epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev);
+}
+
+static size_t raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return 1024;
+    if (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (1 << 20)) rl.rlim_max = 1 << 20;
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return 1024;
+    return rl.rlim_cur == RLIM_INFINITY ? (1 << 20) : (size_t)rl.rlim_cur;
+}
+
 static void do_shutdown(int signo) {
     (void)signo;
     running = 0;
@@ -636,9 +1195,11 @@ static void do_shutdown(int signo) {
     queue_wakeup_all(&client_q);
     queue_wakeup_all(&task_q);
     queue_wakeup_all(&result_q);
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) reactor_wake(&reactors[i]);
 }
 
 int main(int argc, char **argv) {
+    (void)argc; (void)argv;
     srand((unsigned int)time(NULL));
     mkdir("storage", 0755);
 
@@ -646,13 +1207,23 @@ int main(int argc, char **argv) {
     signal(SIGINT, do_shutdown);
     signal(SIGTERM, do_shutdown);
 
-    queue_init(&client_q);
-    queue_init(&task_q);
-    queue_init(&result_q);
+    if (queue_init(&client_q, CLIENT_Q_CAP) < 0 || queue_init(&task_q, TASK_Q_CAP) < 0 ||
+        queue_init(&result_q, RESULT_Q_CAP) < 0) {
+        perror("queue_init");
+        exit(1);
+    }
+
+    conn_table_size = raise_fd_limit();
+    conn_table = calloc(conn_table_size, sizeof(Conn *));
+    if (!conn_table) { perror("calloc"); exit(1); }
 
-    pthread_t client_pool[CLIENT_POOL_SIZE];
-    for (int i = 0; i < CLIENT_POOL_SIZE; ++i)
-        pthread_create(&client_pool[i], NULL, client_thread_fn, NULL);
+    if (meta_open(WORKER_POOL_SIZE) < 0) { perror("meta_open"); exit(1); }
+    if (blobs_open() < 0) { perror("blobs_open"); exit(1); }
+
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) {
+        if (reactor_init(&reactors[i]) < 0) { perror("reactor_init"); exit(1); }
+        pthread_create(&reactors[i].thread, NULL, reactor_thread_fn, &reactors[i]);
+    }
 
     pthread_t worker_pool[WORKER_POOL_SIZE];
     for (int i = 0; i < WORKER_POOL_SIZE; ++i)
@@ -672,46 +1243,58 @@ int main(int argc, char **argv) {
     if (listen(listenfd, BACKLOG) < 0) { perror("listen"); exit(1); }
     printf("server_phase2 listening on %d\n", PORT);
 
+    unsigned next_reactor = 0;
     while (running) {
-        int client = accept(listenfd, NULL, NULL);
+        int client = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (client < 0) {
             if (!running) break;
+            if (errno == EMFILE || errno == ENFILE) {
+                struct timespec ts = { 0, 10 * 1000 * 1000 };
+                nanosleep(&ts, NULL);
+            }
             continue;
         }
-        queue_push(&client_q, (void *)(intptr_t)client);
+        if (queue_push(&client_q, (void *)(intptr_t)client) != 0) { close(client); break; }
+        reactor_wake(&reactors[next_reactor++ % REACTOR_POOL_SIZE]);
     }
 
     queue_wakeup_all(&client_q);
     queue_wakeup_all(&task_q);
     queue_wakeup_all(&result_q);
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) reactor_wake(&reactors[i]);
 
-    for (int i = 0; i < CLIENT_POOL_SIZE; ++i) pthread_join(client_pool[i], NULL);
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) pthread_join(reactors[i].thread, NULL);
     for (int i = 0; i < WORKER_POOL_SIZE; ++i) pthread_join(worker_pool[i], NULL);
     for (int i = 0; i < SENDER_POOL_SIZE; ++i) pthread_join(sender_pool[i], NULL);
 
-    pthread_mutex_lock(&users_mutex);
-    User *u = users_head;
-    while (u) {
-        FileEntry *f = u->files;
-        while (f) { FileEntry *nf = f->next; free(f); f = nf; }
-        User *nu = u->next;
-        pthread_mutex_destroy(&u->lock);
-        free(u);
-        u = nu;
-    }
-    users_head = NULL;
-    pthread_mutex_unlock(&users_mutex);
-
-    pthread_mutex_lock(&filelocks_mutex);
-    FileLockEntry *fl = filelocks_head;
-    while (fl) {
-        FileLockEntry *nf = fl->next;
-        pthread_rwlock_destroy(&fl->rw);
-        free(fl);
-        fl = nf;
-    }
-    filelocks_head = NULL;
-    pthread_mutex_unlock(&filelocks_mutex);
+    void *p;
+    while ((p = queue_trypop(&client_q))) close((int)(intptr_t)p);
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) {
+        pthread_mutex_destroy(&reactors[i].pend_m);
+        close(reactors[i].epfd);
+        close(reactors[i].wakefd);
+        free(reactors[i].upbuf);
+    }
+    for (size_t i = 0; i < conn_table_size; ++i) {
+        if (conn_table[i]) conn_free(conn_table[i]);
+    }
+    free(conn_table);
+    for (int i = 0; i < REACTOR_POOL_SIZE; ++i) {
+        Reactor *r = &reactors[i];
+        printf("pool: reactor %d: %zu tasks from %zu slabs, %zu buffers from %zu slabs\n",
+               i, r->tasks.gets, r->tasks.nslabs, r->bufs.gets, r->bufs.nslabs);
+        pool_destroy(&r->tasks);
+        pool_destroy(&r->bufs);
+    }
+    queue_destroy(&client_q);
+    queue_destroy(&task_q);
+    queue_destroy(&result_q);
+
+    upsess_destroy_all();
+    blobs_close();
+    meta_close();
+    users_destroy();
+    filelocks_destroy();
 
     printf("server shutdown complete\n");
     return 0;
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include "sessions.h"
+
+/*
+ * Sessions sit in a small chained hash keyed by their random id, under one
+ * mutex: it is taken once per chunk, not per byte. Received bytes are kept
+ * as a sorted array of disjoint, non-adjacent [start, end) ranges. A chunk
+ * is counted in `writers` from the moment the reactor starts receiving it
+ * until its bytes are on the file, and a session with writers is never
+ * detached or expired, so the staging file is not renamed under a pwrite.
+ * Sessions nobody has touched for SESSION_IDLE_SECS are dropped when the
+ * next one is created.
+ */
+
+#define SESSION_BUCKETS 64
+#define SESSION_IDLE_SECS (24*60*60)
+
+typedef struct {
+    size_t start, end;
+} Range;
+
+struct UpSession {
+    uint64_t id;
+    char user[MAX_USERNAME];
+    char file[MAX_FILENAME];
+    char path[192];
+    size_t size;
+    int fd;
+    int writers;
+    time_t touched;
+    Range *ranges;
+    size_t nranges, cap;
+    size_t received;
+    struct UpSession *next;
+};
+
+static pthread_mutex_t sess_m = PTHREAD_MUTEX_INITIALIZER;
+static UpSession *buckets[SESSION_BUCKETS];
+
+static UpSession **slot_of(uint64_t id) {
+    UpSession **pp = &buckets[id % SESSION_BUCKETS];
+    while (*pp && (*pp)->id != id) pp = &(*pp)->next;
+    return pp;
+}
+
+static time_t now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+void upsess_free(UpSession *s, int unlink_file) {
+    if (!s) return;
+    if (s->fd >= 0) close(s->fd);
+    if (unlink_file) unlink(s->path);
+    free(s->ranges);
+    free(s);
+}
+
+/* Called with sess_m held. */
+static void expire_idle(time_t now) {
+    for (int i = 0; i < SESSION_BUCKETS; ++i) {
+        UpSession **pp = &buckets[i];
+        while (*pp) {
+            UpSession *s = *pp;
+            if (s->writers || now - s->touched < SESSION_IDLE_SECS) { pp = &s->next; continue; }
+            *pp = s->next;
+            upsess_free(s, 1);
+        }
+    }
+}
+
+UpSession *upsess_create(const char *user, const char *fname, size_t size, uint64_t *id) {
+    UpSession *s = calloc(1, sizeof(UpSession));
+    if (!s) return NULL;
+    snprintf(s->user, sizeof(s->user), "%s", user);
+    snprintf(s->file, sizeof(s->file), "%s", fname);
+    s->size = size;
+    s->fd = -1;
+    do {
+        if (getrandom(&s->id, sizeof(s->id), 0) != sizeof(s->id)) { free(s); return NULL; }
+    } while (!s->id);
+    int n = snprintf(s->path, sizeof(s->path), "storage/%s/.tmp_up_%016llx", user, (unsigned long long)s->id);
+    if (n < 0 || (size_t)n >= sizeof(s->path)) { free(s); errno = ENAMETOOLONG; return NULL; }
+    s->fd = open(s->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (s->fd < 0) { free(s); return NULL; }
+    if (size && fallocate(s->fd, 0, 0, (off_t)size) != 0 && errno == ENOSPC) {
+        upsess_free(s, 1);
+        errno = ENOSPC;
+        return NULL;
+    }
+    if (ftruncate(s->fd, (off_t)size) != 0) { upsess_free(s, 1); return NULL; }
+
+    pthread_mutex_lock(&sess_m);
+    s->touched = now_secs();
+    expire_idle(s->touched);
+    UpSession **pp = slot_of(s->id);
+    if (*pp) {
+        pthread_mutex_unlock(&sess_m);
+        upsess_free(s, 1);
+        errno = EEXIST;
+        return NULL;
+    }
+    *pp = s;
+    pthread_mutex_unlock(&sess_m);
+    *id = s->id;
+    return s;
+}
+
+UpSession *upsess_begin_chunk(uint64_t id, size_t off, size_t len, int *fd, const char **err) {
+    pthread_mutex_lock(&sess_m);
+    UpSession *s = *slot_of(id);
+    if (!s) *err = "ERR no_session\n";
+    else if (off > s->size || len > s->size - off) { *err = "ERR bad_range\n"; s = NULL; }
+    else if ((*fd = dup(s->fd)) < 0) { *err = "ERR io\n"; s = NULL; }
+    else {
+        s->writers++;
+        s->touched = now_secs();
+    }
+    pthread_mutex_unlock(&sess_m);
+    return s;
+}
+
+/* Called with sess_m held. Merges [start, end) into the range array. */
+static void add_range(UpSession *s, size_t start, size_t end) {
+    size_t i = 0;
+    while (i < s->nranges && s->ranges[i].end < start) i++;
+    size_t j = i;
+    while (j < s->nranges && s->ranges[j].start <= end) {
+        if (s->ranges[j].start < start) start = s->ranges[j].start;
+        if (s->ranges[j].end > end) end = s->ranges[j].end;
+        s->received -= s->ranges[j].end - s->ranges[j].start;
+        j++;
+    }
+    if (i == j) {
+        if (s->nranges == s->cap) {
+            size_t cap = s->cap ? s->cap * 2 : 8;
+            Range *r = realloc(s->ranges, cap * sizeof(Range));
+            if (!r) return;
+            s->ranges = r;
+            s->cap = cap;
+        }
+        memmove(&s->ranges[i + 1], &s->ranges[i], (s->nranges - i) * sizeof(Range));
+        s->nranges++;
+    } else if (j > i + 1) {
+        memmove(&s->ranges[i + 1], &s->ranges[j], (s->nranges - j) * sizeof(Range));
+        s->nranges -= j - i - 1;
+    }
+    s->ranges[i] = (Range){ start, end };
+    s->received += end - start;
+}
+
+void upsess_end_chunk(UpSession *s, size_t off, size_t len, int ok) {
+    pthread_mutex_lock(&sess_m);
+    if (ok && len) add_range(s, off, off + len);
+    s->writers--;
+    s->touched = now_secs();
+    pthread_mutex_unlock(&sess_m);
+}
+
+size_t upsess_status(uint64_t id, char *buf, size_t cap) {
+    pthread_mutex_lock(&sess_m);
+    UpSession *s = *slot_of(id);
+    size_t off = 0;
+    if (s) {
+        off = snprintf(buf, cap, "OK %zu %zu\n", s->received, s->size);
+        for (size_t i = 0; i < s->nranges && off + 48 <= cap; ++i)
+            off += snprintf(buf + off, cap - off, "%zu %zu\n", s->ranges[i].start,
+                            s->ranges[i].end - s->ranges[i].start);
+        s->touched = now_secs();
+    }
+    pthread_mutex_unlock(&sess_m);
+    return off;
+}
+
+UpSession *upsess_detach(uint64_t id, int complete, const char **err) {
+    pthread_mutex_lock(&sess_m);
+    UpSession **pp = slot_of(id);
+    UpSession *s = *pp;
+    if (!s) *err = "ERR no_session\n";
+    else if (s->writers) { *err = "ERR busy\n"; s = NULL; }
+    else if (complete && s->received != s->size) { *err = "ERR incomplete\n"; s = NULL; }
+    else *pp = s->next;
+    pthread_mutex_unlock(&sess_m);
+    if (s) {
+        close(s->fd);
+        s->fd = -1;
+    }
+    return s;
+}
+
+const char *upsess_path(const UpSession *s) { return s->path; }
+const char *upsess_user(const UpSession *s) { return s->user; }
+const char *upsess_file(const UpSession *s) { return s->file; }
+size_t upsess_size(const UpSession *s) { return s->size; }
+
+void upsess_destroy_all(void) {
+    pthread_mutex_lock(&sess_m);
+    for (int i = 0; i < SESSION_BUCKETS; ++i) {
+        while (buckets[i]) {
+            UpSession *s = buckets[i];
+            buckets[i] = s->next;
+            upsess_free(s, 1);
+        }
+    }
+    pthread_mutex_unlock(&sess_m);
+}
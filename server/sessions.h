@@ -0,0 +1,43 @@
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "users.h"
+
+/*
+ * Upload sessions: a file of known size staged under the user's directory
+ * and filled by chunks at any offset, over any number of connections and
+ * in any order, until it is committed or aborted. A session outlives the
+ * connections that feed it but not the server.
+ */
+typedef struct UpSession UpSession;
+
+/* Opens a session with a preallocated staging file; NULL with errno set on
+ * failure. *id names it in later commands. */
+UpSession *upsess_create(const char *user, const char *fname, size_t size, uint64_t *id);
+/* Starts writing [off, off+len) of session id. Returns the session and a
+ * descriptor for pwrite() in *fd, or NULL with *err set to a reply. */
+UpSession *upsess_begin_chunk(uint64_t id, size_t off, size_t len, int *fd, const char **err);
+/* Ends a chunk started by upsess_begin_chunk, recording the range if ok. */
+void upsess_end_chunk(UpSession *s, size_t off, size_t len, int ok);
+/* Writes "OK <received> <size>" and then one "<offset> <length>" line per
+ * received range, as far as they fit in cap bytes; 0 if there is no such
+ * session. */
+size_t upsess_status(uint64_t id, char *buf, size_t cap);
+/* Takes session id out of the table so it can be committed or aborted.
+ * Fails with *err set if it does not exist, a chunk is still being written
+ * or, when `complete` is set, not every byte has arrived. */
+UpSession *upsess_detach(uint64_t id, int complete, const char **err);
+/* Staging file path, owner, target name and size of a detached session. */
+const char *upsess_path(const UpSession *s);
+const char *upsess_user(const UpSession *s);
+const char *upsess_file(const UpSession *s);
+size_t upsess_size(const UpSession *s);
+/* Frees a detached session; unlink also removes its staging file. */
+void upsess_free(UpSession *s, int unlink_file);
+/* Drops every session and its staging file. Only safe once all threads
+ * are done. */
+void upsess_destroy_all(void);
+
+#endif
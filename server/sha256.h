@@ -0,0 +1,25 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    unsigned char buf[64];
+    size_t fill;
+} Sha256;
+
+void sha256_init(Sha256 *s);
+void sha256_update(Sha256 *s, const void *p, size_t n);
+void sha256_final(Sha256 *s, unsigned char out[SHA256_LEN]);
+
+/* Lower-case hex, 2*SHA256_LEN chars plus NUL. */
+void sha256_hex(const unsigned char d[SHA256_LEN], char *out);
+/* 0 if hex is exactly 2*SHA256_LEN hex digits, else -1. */
+int sha256_parse(const char *hex, unsigned char d[SHA256_LEN]);
+
+#endif
@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "users.h"
+
+/*
+ * User registry: USER_SHARDS independent open-addressing hash tables,
+ * picked by the top bits of the name's hash. Lookups take no lock at all;
+ * they load the shard's current slot array and probe it. Inserts take the
+ * shard's mutex, fill a slot with a release store, and double the array
+ * once it is half full. Growing publishes a new array and keeps the old
+ * one until shutdown, so a concurrent reader probing it stays safe and at
+ * worst misses a user that was being created at that moment.
+ */
+
+#define USER_SHARDS 64
+#define USER_SHARD_BITS 6
+#define USER_SLOTS_INITIAL 16
+
+typedef struct UserSlots {
+    size_t mask;
+    struct UserSlots *retired;
+    _Atomic(User *) slot[];
+} UserSlots;
+
+typedef struct {
+    pthread_mutex_t lock;
+    _Atomic(UserSlots *) slots;
+    size_t count;
+} __attribute__((aligned(64))) UserShard;
+
+static UserShard shards[USER_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static uint64_t user_hash(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ULL; }
+    return h ^ (h >> 29);
+}
+
+static UserSlots *slots_alloc(size_t n) {
+    UserSlots *t = calloc(1, sizeof(UserSlots) + n * sizeof(_Atomic(User *)));
+    if (t) t->mask = n - 1;
+    return t;
+}
+
+static void shards_init(void) {
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        atomic_init(&shards[i].slots, slots_alloc(USER_SLOTS_INITIAL));
+        shards[i].count = 0;
+    }
+}
+
+static UserShard *shard_for(uint64_t h) {
+    pthread_once(&shards_once, shards_init);
+    return &shards[h >> (64 - USER_SHARD_BITS)];
+}
+
+static User *slots_find(UserSlots *t, uint64_t h, const char *username) {
+    for (size_t i = h & t->mask;; i = (i + 1) & t->mask) {
+        User *u = atomic_load_explicit(&t->slot[i], memory_order_acquire);
+        if (!u) return NULL;
+        if (u->hash == h && strcmp(u->username, username) == 0) return u;
+    }
+}
+
+static void slots_put(UserSlots *t, User *u) {
+    size_t i = u->hash & t->mask;
+    while (atomic_load_explicit(&t->slot[i], memory_order_relaxed)) i = (i + 1) & t->mask;
+    atomic_store_explicit(&t->slot[i], u, memory_order_release);
+}
+
+/*
+ * Per-user file index. Lookups go through the hash chains, which double
+ * once there are as many files as buckets. The treap gives LIST its
+ * sorted order and lets it resume after any name in O(log n); using the
+ * name hash as the heap priority keeps it balanced in expectation without
+ * a random source.
+ */
+
+#define FILE_BUCKETS_INITIAL 16
+
+static int files_grow(FileIndex *ix) {
+    size_t n = ix->buckets ? (ix->mask + 1) * 2 : FILE_BUCKETS_INITIAL;
+    FileEntry **nb = calloc(n, sizeof(FileEntry *));
+    if (!nb) return -1;
+    for (size_t i = 0; ix->buckets && i <= ix->mask; ++i) {
+        FileEntry *f = ix->buckets[i];
+        while (f) {
+            FileEntry *nf = f->hnext;
+            f->hnext = nb[f->hash & (n - 1)];
+            nb[f->hash & (n - 1)] = f;
+            f = nf;
+        }
+    }
+    free(ix->buckets);
+    ix->buckets = nb;
+    ix->mask = n - 1;
+    return 0;
+}
+
+static FileEntry *treap_insert(FileEntry *root, FileEntry *e) {
+    if (!root) return e;
+    if (strcmp(e->name, root->name) < 0) {
+        root->left = treap_insert(root->left, e);
+        if (root->left->hash > root->hash) {
+            FileEntry *l = root->left;
+            root->left = l->right;
+            l->right = root;
+            return l;
+        }
+    } else {
+        root->right = treap_insert(root->right, e);
+        if (root->right->hash > root->hash) {
+            FileEntry *r = root->right;
+            root->right = r->left;
+            r->left = root;
+            return r;
+        }
+    }
+    return root;
+}
+
+/* Joins two treaps where every name in a sorts before every name in b. */
+static FileEntry *treap_merge(FileEntry *a, FileEntry *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->hash > b->hash) { a->right = treap_merge(a->right, b); return a; }
+    b->left = treap_merge(a, b->left);
+    return b;
+}
+
+static FileEntry *treap_remove(FileEntry *root, FileEntry *e) {
+    if (root == e) return treap_merge(e->left, e->right);
+    if (strcmp(e->name, root->name) < 0) root->left = treap_remove(root->left, e);
+    else root->right = treap_remove(root->right, e);
+    return root;
+}
+
+static void files_free(FileIndex *ix) {
+    for (size_t i = 0; ix->buckets && i <= ix->mask; ++i) {
+        FileEntry *f = ix->buckets[i];
+        while (f) { FileEntry *nf = f->hnext; free(f); f = nf; }
+    }
+    free(ix->buckets);
+    memset(ix, 0, sizeof(*ix));
+}
+
+User *find_user(const char *username) {
+    uint64_t h = user_hash(username);
+    UserShard *sh = shard_for(h);
+    UserSlots *t = atomic_load_explicit(&sh->slots, memory_order_acquire);
+    return t ? slots_find(t, h, username) : NULL;
+}
+
+/* Called with sh->lock held. */
+static int shard_grow(UserShard *sh) {
+    UserSlots *old = atomic_load_explicit(&sh->slots, memory_order_relaxed);
+    UserSlots *t = slots_alloc((old->mask + 1) * 2);
+    if (!t) return -1;
+    for (size_t i = 0; i <= old->mask; ++i) {
+        User *u = atomic_load_explicit(&old->slot[i], memory_order_relaxed);
+        if (u) slots_put(t, u);
+    }
+    t->retired = old;
+    atomic_store_explicit(&sh->slots, t, memory_order_release);
+    return 0;
+}
+
+User *users_insert(const char *username) {
+    uint64_t h = user_hash(username);
+    UserShard *sh = shard_for(h);
+    pthread_mutex_lock(&sh->lock);
+    UserSlots *t = atomic_load_explicit(&sh->slots, memory_order_relaxed);
+    if (!t || slots_find(t, h, username)) { pthread_mutex_unlock(&sh->lock); return NULL; }
+    if ((sh->count + 1) * 2 > t->mask + 1 && shard_grow(sh) != 0) {
+        pthread_mutex_unlock(&sh->lock);
+        return NULL;
+    }
+    User *u = calloc(1, sizeof(User));
+    if (!u) { pthread_mutex_unlock(&sh->lock); return NULL; }
+    strncpy(u->username, username, sizeof(u->username)-1);
+    u->hash = h;
+    u->quota_bytes = DEFAULT_QUOTA_BYTES;
+    u->used_bytes = 0;
+    pthread_mutex_init(&u->lock, NULL);
+    slots_put(atomic_load_explicit(&sh->slots, memory_order_relaxed), u);
+    sh->count++;
+    pthread_mutex_unlock(&sh->lock);
+    return u;
+}
+
+void users_foreach(void (*fn)(User *u, void *arg), void *arg) {
+    pthread_once(&shards_once, shards_init);
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        UserSlots *t = atomic_load_explicit(&shards[i].slots, memory_order_acquire);
+        for (size_t j = 0; t && j <= t->mask; ++j) {
+            User *u = atomic_load_explicit(&t->slot[j], memory_order_acquire);
+            if (u) fn(u, arg);
+        }
+    }
+}
+
+void users_destroy(void) {
+    pthread_once(&shards_once, shards_init);
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        UserShard *sh = &shards[i];
+        pthread_mutex_lock(&sh->lock);
+        UserSlots *t = atomic_load_explicit(&sh->slots, memory_order_relaxed);
+        for (size_t j = 0; t && j <= t->mask; ++j) {
+            User *u = atomic_load_explicit(&t->slot[j], memory_order_relaxed);
+            if (!u) continue;
+            files_free(&u->files);
+            pthread_mutex_destroy(&u->lock);
+            free(u);
+        }
+        while (t) { UserSlots *nt = t->retired; free(t); t = nt; }
+        atomic_store_explicit(&sh->slots, slots_alloc(USER_SLOTS_INITIAL), memory_order_relaxed);
+        sh->count = 0;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+FileEntry *add_file_to_user(User *u, const char *fname, size_t fsize) {
+    FileIndex *ix = &u->files;
+    if (ix->count + 1 > (ix->buckets ? ix->mask + 1 : 0) && files_grow(ix) != 0) return NULL;
+    size_t len = strnlen(fname, MAX_FILENAME - 1);
+    FileEntry *fe = calloc(1, sizeof(FileEntry) + len + 1);
+    if (!fe) return NULL;
+    memcpy(fe->name, fname, len);
+    fe->size = fsize;
+    fe->hash = user_hash(fe->name);
+    FileEntry **b = &ix->buckets[fe->hash & ix->mask];
+    fe->hnext = *b;
+    *b = fe;
+    ix->root = treap_insert(ix->root, fe);
+    ix->count++;
+    u->used_bytes += fsize;
+    return fe;
+}
+
+FileEntry *find_user_file(User *u, const char *fname) {
+    FileIndex *ix = &u->files;
+    if (!ix->buckets) return NULL;
+    uint64_t h = user_hash(fname);
+    for (FileEntry *f = ix->buckets[h & ix->mask]; f; f = f->hnext)
+        if (f->hash == h && strcmp(f->name, fname) == 0) return f;
+    return NULL;
+}
+
+int remove_file_from_user(User *u, const char *fname) {
+    FileIndex *ix = &u->files;
+    if (!ix->buckets) return -1;
+    uint64_t h = user_hash(fname);
+    for (FileEntry **pp = &ix->buckets[h & ix->mask]; *pp; pp = &(*pp)->hnext) {
+        FileEntry *f = *pp;
+        if (f->hash != h || strcmp(f->name, fname) != 0) continue;
+        *pp = f->hnext;
+        ix->root = treap_remove(ix->root, f);
+        ix->count--;
+        u->used_bytes -= f->size;
+        free(f);
+        return 0;
+    }
+    return -1;
+}
+
+FileEntry *set_user_file(User *u, const char *fname, size_t fsize) {
+    FileEntry *f = find_user_file(u, fname);
+    if (!f) return add_file_to_user(u, fname, fsize);
+    u->used_bytes = u->used_bytes - f->size + fsize;
+    f->size = fsize;
+    memset(f->digest, 0, sizeof(f->digest));
+    return f;
+}
+
+int file_has_digest(const FileEntry *f) {
+    for (int i = 0; i < SHA256_LEN; ++i)
+        if (f->digest[i]) return 1;
+    return 0;
+}
+
+FileEntry *next_user_file(User *u, const char *after) {
+    FileEntry *best = NULL;
+    for (FileEntry *f = u->files.root; f; ) {
+        if (!after || strcmp(f->name, after) > 0) { best = f; f = f->left; }
+        else f = f->right;
+    }
+    return best;
+}
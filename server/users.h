@@ -0,0 +1,61 @@
+#ifndef USERS_H
+#define USERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "sha256.h"
+
+#define MAX_USERNAME 64
+#define MAX_FILENAME 256
+#define DEFAULT_QUOTA_BYTES (100*1024*1024)
+
+/* digest is the SHA-256 of the content, all zero when it is not known. */
+typedef struct FileEntry {
+    size_t size;
+    uint64_t hash;
+    unsigned char digest[SHA256_LEN];
+    struct FileEntry *hnext;
+    struct FileEntry *left, *right;
+    char name[];
+} FileEntry;
+
+/* A user's files: a chained hash table for lookups plus a treap, ordered by
+ * name and heap-ordered by hash, over the same entries for listing. */
+typedef struct FileIndex {
+    FileEntry **buckets;
+    size_t mask;
+    size_t count;
+    FileEntry *root;
+} FileIndex;
+
+/* Users are never removed, so a User pointer stays valid until shutdown. */
+typedef struct User {
+    char username[MAX_USERNAME];
+    uint64_t hash;
+    size_t quota_bytes;
+    size_t used_bytes;
+    FileIndex files;
+    pthread_mutex_t lock;
+} User;
+
+/* Lock-free lookup; NULL if there is no such user. */
+User *find_user(const char *username);
+/* Adds a user to the registry; NULL if the name is taken or on OOM. */
+User *users_insert(const char *username);
+/* Calls fn on every user; users added meanwhile may or may not be seen. */
+void users_foreach(void (*fn)(User *u, void *arg), void *arg);
+/* Frees every user and file entry. Only safe once all threads are done. */
+void users_destroy(void);
+
+/* Callers hold u->lock. */
+FileEntry *find_user_file(User *u, const char *fname);
+FileEntry *add_file_to_user(User *u, const char *fname, size_t fsize);
+int remove_file_from_user(User *u, const char *fname);
+/* Adds fname or, if it exists, replaces its size and clears its digest. */
+FileEntry *set_user_file(User *u, const char *fname, size_t fsize);
+int file_has_digest(const FileEntry *f);
+/* First file whose name sorts after `after` (the first file if NULL). */
+FileEntry *next_user_file(User *u, const char *after);
+
+#endif
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "filelock.h"
+
+/*
+ * get/lock/unlock/release churn on the file-lock table (server/filelock.c)
+ * next to the old single-mutex list, at 1..max_threads threads. "private"
+ * gives every thread its own files, "shared" has all threads read-locking
+ * the same small set.
+ *   ./bench_filelock [files_per_thread] [max_threads] [ops_per_thread]
+ */
+
+#define SHARED_FILES 16
+
+static int files_per_thread;
+static long ops_per_thread;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The table as it was: one list, one mutex, snprintf'd key, lookup on release. */
+typedef struct OldEntry {
+    char key[512];
+    pthread_rwlock_t rw;
+    int refcount;
+    struct OldEntry *next;
+} OldEntry;
+static OldEntry *old_head;
+static pthread_mutex_t old_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_rwlock_t *old_get(const char *user, const char *fname) {
+    char key[512];
+    snprintf(key, sizeof(key), "%s/%s", user, fname);
+    pthread_mutex_lock(&old_mutex);
+    for (OldEntry *e = old_head; e; e = e->next)
+        if (strcmp(e->key, key) == 0) { e->refcount++; pthread_mutex_unlock(&old_mutex); return &e->rw; }
+    OldEntry *e = calloc(1, sizeof(OldEntry));
+    memcpy(e->key, key, sizeof(e->key));
+    pthread_rwlock_init(&e->rw, NULL);
+    e->refcount = 1;
+    e->next = old_head;
+    old_head = e;
+    pthread_mutex_unlock(&old_mutex);
+    return &e->rw;
+}
+static void old_release(const char *user, const char *fname) {
+    char key[512];
+    snprintf(key, sizeof(key), "%s/%s", user, fname);
+    pthread_mutex_lock(&old_mutex);
+    OldEntry **pp = &old_head;
+    while (*pp && strcmp((*pp)->key, key) != 0) pp = &(*pp)->next;
+    OldEntry *e = *pp;
+    if (e && --e->refcount == 0) {
+        *pp = e->next;
+        pthread_rwlock_destroy(&e->rw);
+        free(e);
+    }
+    pthread_mutex_unlock(&old_mutex);
+}
+
+typedef struct {
+    int id, shared, use_old;
+} Arg;
+
+static void *churn_fn(void *p) {
+    Arg *a = p;
+    char user[32], fname[64];
+    snprintf(user, sizeof(user), "user%d", a->shared ? 0 : a->id);
+    unsigned s = 7919u * (a->id + 1);
+    int nfiles = a->shared ? SHARED_FILES : files_per_thread;
+    for (long i = 0; i < ops_per_thread; ++i) {
+        s = s * 1103515245u + 12345u;
+        snprintf(fname, sizeof(fname), "file_%u.dat", (s >> 4) % (unsigned)nfiles);
+        int write = !a->shared && (i & 3) == 0;
+        if (a->use_old) {
+            pthread_rwlock_t *l = old_get(user, fname);
+            if (write) pthread_rwlock_wrlock(l); else pthread_rwlock_rdlock(l);
+            pthread_rwlock_unlock(l);
+            old_release(user, fname);
+        } else {
+            FileLock *l = get_file_lock(user, fname);
+            if (write) file_wrlock(l); else file_rdlock(l);
+            file_unlock(l);
+            release_file_lock(l);
+        }
+    }
+    return NULL;
+}
+
+/* Idle references so the old list has a realistic number of entries to scan. */
+static FileLock **held;
+static int nheld;
+
+static void hold_files(int nthreads, int use_old, int hold) {
+    char user[32], fname[64];
+    if (!use_old && hold) held = malloc(sizeof(FileLock *) * nthreads * files_per_thread);
+    for (int t = 0; t < nthreads; ++t) {
+        snprintf(user, sizeof(user), "user%d", t);
+        for (int f = 0; f < files_per_thread; ++f) {
+            snprintf(fname, sizeof(fname), "file_%d.dat", f);
+            if (use_old) {
+                if (hold) old_get(user, fname); else old_release(user, fname);
+            } else if (hold) {
+                held[nheld++] = get_file_lock(user, fname);
+            } else {
+                release_file_lock(held[--nheld]);
+            }
+        }
+    }
+    if (!use_old && !hold) { free(held); held = NULL; }
+}
+
+static void run(const char *name, int nthreads, int shared, int use_old) {
+    pthread_t th[nthreads];
+    Arg args[nthreads];
+    hold_files(nthreads, use_old, 1);
+    double t0 = now_sec();
+    for (int i = 0; i < nthreads; ++i) {
+        args[i] = (Arg){ i, shared, use_old };
+        pthread_create(&th[i], NULL, churn_fn, &args[i]);
+    }
+    for (int i = 0; i < nthreads; ++i) pthread_join(th[i], NULL);
+    double elapsed = now_sec() - t0;
+    hold_files(nthreads, use_old, 0);
+    printf("%-4s %-8s threads=%-2d files=%-6d ops/s=%.0f\n", name, shared ? "shared" : "private",
+           nthreads, nthreads * files_per_thread, nthreads * ops_per_thread / elapsed);
+}
+
+int main(int argc, char **argv) {
+    files_per_thread = argc >= 2 ? atoi(argv[1]) : 256;
+    int max_threads = argc >= 3 ? atoi(argv[2]) : 8;
+    ops_per_thread = argc >= 4 ? atol(argv[3]) : 200000;
+    if (files_per_thread < 1) files_per_thread = 1;
+
+    for (int shared = 0; shared <= 1; ++shared)
+        for (int th = 1; th <= max_threads; th *= 2) {
+            run("old", th, shared, 1);
+            run("new", th, shared, 0);
+        }
+    filelocks_destroy();
+    return 0;
+}
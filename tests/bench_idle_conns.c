@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Holds a large number of idle connections open against the server and
+ * measures LIST latency on one active connection, first with no idle
+ * connections and then with all of them open.
+ *   ./bench_idle_conns [idle_conns] [requests]
+ */
+
+#define DEFAULT_SERVER "127.0.0.1"
+#define DEFAULT_PORT 9000
+#define RESPONSE_TIMEOUT_SEC 5
+
+static int connect_server(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(DEFAULT_PORT);
+    inet_pton(AF_INET, DEFAULT_SERVER, &sa.sin_addr);
+    if (connect(sock, (struct sockaddr*)&sa, sizeof(sa)) < 0) { close(sock); return -1; }
+    return sock;
+}
+
+static int send_all(int sock, const void *buf, size_t len) {
+    size_t sent = 0;
+    const char *p = buf;
+    while (sent < len) {
+        ssize_t s = send(sock, p + sent, len - sent, 0);
+        if (s <= 0) return -1;
+        sent += s;
+    }
+    return 0;
+}
+
+static ssize_t recv_line(int sock, char *buf, size_t maxlen) {
+    size_t n = 0; char c;
+    while (n + 1 < maxlen) {
+        ssize_t r = recv(sock, &c, 1, 0);
+        if (r <= 0) return -1;
+        buf[n++] = c;
+        if (c == '\n') break;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_phase(int idle, int requests) {
+    int sock = connect_server();
+    if (sock < 0) { perror("connect"); return -1; }
+    struct timeval tv = { RESPONSE_TIMEOUT_SEC, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char buf[1024];
+    send_all(sock, "SIGNUP bench_idle\n", 18);
+    if (recv_line(sock, buf, sizeof(buf)) <= 0) {
+        printf("idle=%-6d no response within %ds\n", idle, RESPONSE_TIMEOUT_SEC);
+        close(sock);
+        return -1;
+    }
+
+    double *lat = malloc(sizeof(double) * requests);
+    if (!lat) { close(sock); return -1; }
+    double start = now_us();
+    int done = 0;
+    for (; done < requests; ++done) {
+        double t0 = now_us();
+        if (send_all(sock, "LIST bench_idle\n", 16) < 0) break;
+        int ok = 0;
+        while (recv_line(sock, buf, sizeof(buf)) > 0) {
+            if (strcmp(buf, "END\n") == 0 || strncmp(buf, "ERR", 3) == 0) { ok = 1; break; }
+        }
+        if (!ok) break;
+        lat[done] = now_us() - t0;
+    }
+    double elapsed = now_us() - start;
+    close(sock);
+    if (done == 0) { printf("idle=%-6d no LIST completed\n", idle); free(lat); return -1; }
+
+    qsort(lat, done, sizeof(double), cmp_double);
+    printf("idle=%-6d requests=%-6d req/s=%-9.0f p50=%.1fus p99=%.1fus max=%.1fus\n",
+           idle, done, done / (elapsed / 1e6),
+           lat[done / 2], lat[(size_t)(done * 0.99)], lat[done - 1]);
+    free(lat);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int idle = argc >= 2 ? atoi(argv[1]) : 10000;
+    int requests = argc >= 3 ? atoi(argv[2]) : 2000;
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur != RLIM_INFINITY && (rlim_t)idle + 16 > rl.rlim_cur) {
+            idle = (int)rl.rlim_cur - 16;
+            printf("fd limit %lu, capping idle connections at %d\n", (unsigned long)rl.rlim_cur, idle);
+        }
+    }
+
+    run_phase(0, requests);
+
+    int *socks = malloc(sizeof(int) * idle);
+    if (!socks) return 1;
+    int opened = 0;
+    for (; opened < idle; ++opened) {
+        socks[opened] = connect_server();
+        if (socks[opened] < 0) { perror("connect idle"); break; }
+    }
+    int rc = run_phase(opened, requests);
+    for (int i = 0; i < opened; ++i) close(socks[i]);
+    free(socks);
+    return rc < 0 ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "users.h"
+#include "meta.h"
+
+/*
+ * Startup cost of the metadata store (server/meta.c): journals a registry
+ * of users x files, snapshots it, then restores it from the snapshot. A
+ * second, smaller tree of real files is rebuilt with the storage/ scan.
+ * Runs in a fresh directory under /tmp.
+ *   ./bench_meta [users] [files_per_user] [scan_files] [scan_threads]
+ */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void rm_tree(const char *dir) {
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0) fprintf(stderr, "failed: %s\n", cmd);
+}
+
+static size_t count_files(void) {
+    size_t n = 0;
+    char uname[MAX_USERNAME];
+    for (int i = 0;; ++i) {
+        snprintf(uname, sizeof(uname), "user%06d", i);
+        User *u = find_user(uname);
+        if (!u) return n;
+        n += u->files.count;
+    }
+}
+
+int main(int argc, char **argv) {
+    int users = argc >= 2 ? atoi(argv[1]) : 1000;
+    int per_user = argc >= 3 ? atoi(argv[2]) : 1000;
+    int scan_files = argc >= 4 ? atoi(argv[3]) : 50000;
+    int scan_threads = argc >= 5 ? atoi(argv[4]) : 4;
+
+    char dir[] = "/tmp/bench_meta_XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) { perror("mkdtemp"); return 1; }
+
+    if (meta_open(scan_threads) < 0) { perror("meta_open"); return 1; }
+    char uname[MAX_USERNAME], fname[MAX_FILENAME];
+    double t0 = now_sec();
+    for (int i = 0; i < users; ++i) {
+        snprintf(uname, sizeof(uname), "user%06d", i);
+        User *u = users_insert(uname);
+        meta_log_user(uname);
+        pthread_mutex_lock(&u->lock);
+        for (int j = 0; j < per_user; ++j) {
+            snprintf(fname, sizeof(fname), "document_%08d.dat", j);
+            set_user_file(u, fname, (size_t)j * 17);
+            meta_log_put(uname, fname, (size_t)j * 17, NULL);
+        }
+        pthread_mutex_unlock(&u->lock);
+    }
+    double t1 = now_sec();
+    meta_close();
+    double t2 = now_sec();
+    struct stat st;
+    stat("storage/.meta/snapshot", &st);
+    size_t total = (size_t)users * per_user;
+    printf("journal  files=%-9zu appends/s=%.0f\n", total, total / (t1 - t0));
+    printf("snapshot files=%-9zu %.3fs bytes=%lld\n", total, t2 - t1, (long long)st.st_size);
+
+    users_destroy();
+    t0 = now_sec();
+    if (meta_open(scan_threads) < 0) { perror("meta_open"); return 1; }
+    t1 = now_sec();
+    printf("restore  files=%-9zu %.3fs (%zu files back)\n", total, t1 - t0, count_files());
+    meta_close();
+    users_destroy();
+    rm_tree("storage");
+
+    int scan_users = scan_files / 100 > 0 ? scan_files / 100 : 1;
+    mkdir("storage", 0755);
+    for (int i = 0; i < scan_users; ++i) {
+        char path[256];
+        snprintf(path, sizeof(path), "storage/user%06d", i);
+        mkdir(path, 0755);
+        for (int j = 0; j < scan_files / scan_users; ++j) {
+            snprintf(path, sizeof(path), "storage/user%06d/f%05d", i, j);
+            int fd = open(path, O_WRONLY | O_CREAT, 0644);
+            if (fd >= 0) { if (ftruncate(fd, j) != 0) perror("ftruncate"); close(fd); }
+        }
+    }
+    t0 = now_sec();
+    if (meta_open(scan_threads) < 0) { perror("meta_open"); return 1; }
+    t1 = now_sec();
+    printf("scan     files=%-9zu threads=%d %.3fs\n", count_files(), scan_threads, t1 - t0);
+    meta_close();
+    users_destroy();
+
+    if (chdir("/tmp") == 0) rm_tree(dir);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "pool.h"
+#include "queue.h"
+
+/*
+ * Task lifecycle as the server runs it: one owner thread creates
+ * task-sized objects and hands them to consumer threads, which are done
+ * with them on their own thread. "malloc" callocs on the owner and frees
+ * on the consumer; "pool" takes from the owner's Pool (server/pool.c) and
+ * has consumers send objects back for the owner to return.
+ *   ./bench_pool [objects] [max_consumers] [object_size]
+ */
+
+#define CAPACITY 1024
+/* Room for every object that can be out, so returns never block. */
+#define BACK_CAPACITY (4 * CAPACITY)
+
+static long objects;
+static size_t obj_size;
+static Queue work_q, back_q;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *consumer_fn(void *arg) {
+    int use_pool = *(int *)arg;
+    char *o;
+    while ((o = queue_pop(&work_q))) {
+        o[obj_size - 1] = 1;
+        if (use_pool) queue_push(&back_q, o);
+        else free(o);
+    }
+    return NULL;
+}
+
+static void run(int nconsumers, int use_pool) {
+    Pool pool;
+    pool_init(&pool, obj_size, 64);
+    queue_init(&work_q, CAPACITY);
+    queue_init(&back_q, BACK_CAPACITY);
+    pthread_t th[nconsumers];
+    for (int i = 0; i < nconsumers; ++i) pthread_create(&th[i], NULL, consumer_fn, &use_pool);
+    double t0 = now_sec();
+    for (long i = 0; i < objects; ++i) {
+        char *o;
+        if (use_pool) {
+            void *b;
+            while ((b = queue_trypop(&back_q))) pool_put(&pool, b);
+            o = pool_get(&pool);
+            memset(o, 0, obj_size);
+        } else {
+            o = calloc(1, obj_size);
+        }
+        queue_push(&work_q, o);
+    }
+    queue_wakeup_all(&work_q);
+    for (int i = 0; i < nconsumers; ++i) pthread_join(th[i], NULL);
+    double elapsed = now_sec() - t0;
+    printf("%-6s consumers=%-2d objects/s=%.0f slabs=%zu\n", use_pool ? "pool" : "malloc",
+           nconsumers, objects / elapsed, pool.nslabs);
+    pool_destroy(&pool);
+    queue_destroy(&work_q);
+    queue_destroy(&back_q);
+}
+
+int main(int argc, char **argv) {
+    objects = argc >= 2 ? atol(argv[1]) : 2000000;
+    int max_consumers = argc >= 3 ? atoi(argv[2]) : 4;
+    obj_size = argc >= 4 ? (size_t)atol(argv[3]) : 704;
+    if (obj_size < sizeof(void *)) obj_size = sizeof(void *);
+
+    for (int c = 1; c <= max_consumers; c *= 2) {
+        run(c, 0);
+        run(c, 1);
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "queue.h"
+
+/*
+ * The bounded ring (server/queue.c) next to the old malloc-per-node
+ * GenQueue. "tput" moves items from P producers to P consumers through
+ * one queue; "rtt" bounces one item between two threads over a pair of
+ * queues, so each hop goes through a sleeping consumer's wakeup.
+ *   ./bench_queue [items_per_producer] [max_threads] [round_trips]
+ */
+
+#define CAPACITY 1024
+
+static long items_per_producer;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The queue as it was: unbounded list, one mutex and condvar. */
+typedef struct Node {
+    void *val;
+    struct Node *next;
+} Node;
+
+typedef struct {
+    Node *head, *tail;
+    pthread_mutex_t m;
+    pthread_cond_t nonempty;
+} GenQueue;
+
+static void old_init(GenQueue *q) {
+    q->head = q->tail = NULL;
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->nonempty, NULL);
+}
+static void old_push(GenQueue *q, void *v) {
+    Node *n = malloc(sizeof(Node));
+    n->val = v; n->next = NULL;
+    pthread_mutex_lock(&q->m);
+    if (q->tail) q->tail->next = n; else q->head = n;
+    q->tail = n;
+    pthread_cond_signal(&q->nonempty);
+    pthread_mutex_unlock(&q->m);
+}
+static void *old_pop(GenQueue *q) {
+    pthread_mutex_lock(&q->m);
+    while (!q->head) pthread_cond_wait(&q->nonempty, &q->m);
+    Node *n = q->head;
+    q->head = n->next;
+    if (!q->head) q->tail = NULL;
+    pthread_mutex_unlock(&q->m);
+    void *v = n->val;
+    free(n);
+    return v;
+}
+
+typedef struct {
+    int use_old;
+    GenQueue *oq[2];
+    Queue *nq[2];
+} Pair;
+
+static void push(Pair *p, int i, void *v) {
+    if (p->use_old) old_push(p->oq[i], v); else queue_push(p->nq[i], v);
+}
+static void *pop(Pair *p, int i) {
+    return p->use_old ? old_pop(p->oq[i]) : queue_pop(p->nq[i]);
+}
+
+#define STOP ((void *)(intptr_t)-1)
+
+static void *producer_fn(void *arg) {
+    Pair *p = arg;
+    for (long i = 1; i <= items_per_producer; ++i) push(p, 0, (void *)(intptr_t)i);
+    return NULL;
+}
+static void *consumer_fn(void *arg) {
+    Pair *p = arg;
+    while (pop(p, 0) != STOP) { }
+    return NULL;
+}
+
+static void run_tput(Pair *p, int nthreads) {
+    pthread_t prod[nthreads], cons[nthreads];
+    double t0 = now_sec();
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_create(&cons[i], NULL, consumer_fn, p);
+        pthread_create(&prod[i], NULL, producer_fn, p);
+    }
+    for (int i = 0; i < nthreads; ++i) pthread_join(prod[i], NULL);
+    for (int i = 0; i < nthreads; ++i) push(p, 0, STOP);
+    for (int i = 0; i < nthreads; ++i) pthread_join(cons[i], NULL);
+    double elapsed = now_sec() - t0;
+    printf("%-4s tput threads=%dx%-2d items/s=%.0f\n", p->use_old ? "old" : "new",
+           nthreads, nthreads, nthreads * items_per_producer / elapsed);
+}
+
+static void *echo_fn(void *arg) {
+    Pair *p = arg;
+    void *v;
+    while ((v = pop(p, 0)) != STOP) push(p, 1, v);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_rtt(Pair *p, long trips) {
+    double *lat = malloc(sizeof(double) * trips);
+    pthread_t th;
+    pthread_create(&th, NULL, echo_fn, p);
+    for (long i = 0; i < trips; ++i) {
+        double t0 = now_sec();
+        push(p, 0, (void *)(intptr_t)(i + 1));
+        pop(p, 1);
+        lat[i] = (now_sec() - t0) * 1e6;
+    }
+    push(p, 0, STOP);
+    pthread_join(th, NULL);
+    qsort(lat, trips, sizeof(double), cmp_double);
+    printf("%-4s rtt  trips=%ld p50=%.1fus p99=%.1fus max=%.1fus\n", p->use_old ? "old" : "new",
+           trips, lat[trips / 2], lat[trips * 99 / 100], lat[trips - 1]);
+    free(lat);
+}
+
+int main(int argc, char **argv) {
+    items_per_producer = argc >= 2 ? atol(argv[1]) : 1000000;
+    int max_threads = argc >= 3 ? atoi(argv[2]) : 4;
+    long trips = argc >= 4 ? atol(argv[3]) : 100000;
+    if (trips < 1) trips = 1;
+
+    GenQueue oq[2];
+    Queue nq[2];
+    for (int i = 0; i < 2; ++i) {
+        old_init(&oq[i]);
+        if (queue_init(&nq[i], CAPACITY) < 0) { perror("queue_init"); return 1; }
+    }
+    for (int th = 1; th <= max_threads; th *= 2) {
+        for (int use_old = 1; use_old >= 0; --use_old) {
+            Pair p = { use_old, { &oq[0], &oq[1] }, { &nq[0], &nq[1] } };
+            run_tput(&p, th);
+        }
+    }
+    for (int use_old = 1; use_old >= 0; --use_old) {
+        Pair p = { use_old, { &oq[0], &oq[1] }, { &nq[0], &nq[1] } };
+        run_rtt(&p, trips);
+    }
+    for (int i = 0; i < 2; ++i) queue_destroy(&nq[i]);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/*
+ * Compares the old byte-at-a-time recv_line with the server's buffered
+ * per-connection reader on the same request stream (command lines, with a
+ * small payload after every UPLOAD), counting recv() calls per request.
+ *   ./bench_recv_line [requests]
+ */
+
+#define LINEBUF 1024
+#define RECVBUF_SIZE (16*1024)
+#define PAYLOAD 64
+
+static long recv_calls;
+
+static ssize_t counted_recv(int sock, void *buf, size_t len) {
+    recv_calls++;
+    return recv(sock, buf, len, 0);
+}
+
+/* The server's original reader. */
+static ssize_t recv_line(int sock, char *buf, size_t maxlen) {
+    size_t n = 0;
+    char c;
+    while (n + 1 < maxlen) {
+        ssize_t r = counted_recv(sock, &c, 1);
+        if (r == 0 && n == 0) return 0;
+        if (r <= 0) return -1;
+        buf[n++] = c;
+        if (c == '\n') break;
+    }
+    buf[n] = '\0';
+    return (ssize_t)n;
+}
+static ssize_t recv_all(int sock, void *buf, size_t len) {
+    size_t total = 0;
+    char *p = buf;
+    while (total < len) {
+        ssize_t r = counted_recv(sock, p + total, len - total);
+        if (r <= 0) return -1;
+        total += r;
+    }
+    return (ssize_t)total;
+}
+
+/* Same logic as RecvBuf in server/server.c. */
+typedef struct RecvBuf {
+    int fd;
+    char *data;
+    size_t start, end;
+} RecvBuf;
+
+static ssize_t rbuf_fill(RecvBuf *b) {
+    if (!b->data && !(b->data = malloc(RECVBUF_SIZE))) return -1;
+    if (b->start == b->end) {
+        b->start = b->end = 0;
+    } else if (b->end == RECVBUF_SIZE) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+    ssize_t r = counted_recv(b->fd, b->data + b->end, RECVBUF_SIZE - b->end);
+    if (r > 0) b->end += (size_t)r;
+    return r;
+}
+static size_t rbuf_getline(RecvBuf *b, char *out, size_t maxlen) {
+    size_t avail = b->end - b->start;
+    size_t scan = avail < maxlen - 1 ? avail : maxlen - 1;
+    char *nl = scan ? memchr(b->data + b->start, '\n', scan) : NULL;
+    size_t n;
+    if (nl) n = (size_t)(nl - (b->data + b->start)) + 1;
+    else if (avail >= maxlen - 1) n = maxlen - 1;
+    else return 0;
+    memcpy(out, b->data + b->start, n);
+    out[n] = '\0';
+    b->start += n;
+    return n;
+}
+static ssize_t rbuf_take(RecvBuf *b, size_t max, const char **p) {
+    if (b->start == b->end && rbuf_fill(b) <= 0) return -1;
+    size_t n = b->end - b->start;
+    if (n > max) n = max;
+    *p = b->data + b->start;
+    b->start += n;
+    return (ssize_t)n;
+}
+
+typedef struct {
+    int sock;
+    const char *data;
+    size_t len;
+} WriterArg;
+
+static void *writer_fn(void *arg) {
+    WriterArg *wa = arg;
+    size_t off = 0;
+    while (off < wa->len) {
+        ssize_t s = send(wa->sock, wa->data + off, wa->len - off, 0);
+        if (s <= 0) break;
+        off += s;
+    }
+    shutdown(wa->sock, SHUT_WR);
+    return NULL;
+}
+
+static char *build_stream(int requests, size_t *len) {
+    size_t cap = (size_t)requests * (64 + PAYLOAD);
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    size_t off = 0;
+    for (int i = 0; i < requests; ++i) {
+        if (i % 4 == 0) {
+            off += snprintf(buf + off, cap - off, "UPLOAD user%d file_%d.txt %d\n", i % 10, i, PAYLOAD);
+            memset(buf + off, 'x', PAYLOAD);
+            off += PAYLOAD;
+        } else {
+            off += snprintf(buf + off, cap - off, "LIST user%d\n", i % 10);
+        }
+    }
+    *len = off;
+    return buf;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_upload_size(const char *line, size_t *size) {
+    char u[64], f[256];
+    return sscanf(line, "UPLOAD %63s %255s %zu", u, f, size) == 3;
+}
+
+static void run(const char *name, int buffered, const char *stream, size_t len) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) { perror("socketpair"); exit(1); }
+    WriterArg wa = { sv[1], stream, len };
+    pthread_t wt;
+    recv_calls = 0;
+    double t0 = now_sec();
+    pthread_create(&wt, NULL, writer_fn, &wa);
+
+    char line[LINEBUF], payload[PAYLOAD];
+    RecvBuf rb = { sv[0], NULL, 0, 0 };
+    long requests = 0;
+    for (;;) {
+        size_t size;
+        if (buffered) {
+            if (!rbuf_getline(&rb, line, sizeof(line))) {
+                if (rbuf_fill(&rb) <= 0) break;
+                continue;
+            }
+            if (parse_upload_size(line, &size)) {
+                while (size) {
+                    const char *p;
+                    ssize_t r = rbuf_take(&rb, size, &p);
+                    if (r <= 0) break;
+                    size -= r;
+                }
+            }
+        } else {
+            if (recv_line(sv[0], line, sizeof(line)) <= 0) break;
+            if (parse_upload_size(line, &size) && recv_all(sv[0], payload, size) < 0) break;
+        }
+        requests++;
+    }
+    double elapsed = now_sec() - t0;
+    pthread_join(wt, NULL);
+    close(sv[0]);
+    close(sv[1]);
+    free(rb.data);
+    printf("%-10s requests=%-8ld recv_calls=%-9ld recv/request=%-8.3f ns/request=%.0f\n",
+           name, requests, recv_calls, (double)recv_calls / requests, elapsed * 1e9 / requests);
+}
+
+int main(int argc, char **argv) {
+    int requests = argc >= 2 ? atoi(argv[1]) : 200000;
+    size_t len;
+    char *stream = build_stream(requests, &len);
+    if (!stream) return 1;
+    run("bytewise", 0, stream, len);
+    run("buffered", 1, stream, len);
+    free(stream);
+    return 0;
+}
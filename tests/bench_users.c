@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "users.h"
+
+/*
+ * Create and lookup throughput of the user registry (server/users.c) at
+ * 1..max_threads threads, next to the old mutex-protected linked list at
+ * sizes where that is still measurable.
+ *   ./bench_users [users] [max_threads] [lookups_per_thread]
+ */
+
+#define NAME_LEN 16
+#define LIST_MAX_USERS 20000
+
+static char (*names)[NAME_LEN];
+static int nusers;
+static long lookups_per_thread;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    int id, nthreads;
+    unsigned seed;
+    long found;
+} Arg;
+
+static void *insert_fn(void *p) {
+    Arg *a = p;
+    for (int i = a->id; i < nusers; i += a->nthreads) users_insert(names[i]);
+    return NULL;
+}
+
+static void *lookup_fn(void *p) {
+    Arg *a = p;
+    unsigned s = a->seed;
+    long found = 0;
+    for (long i = 0; i < lookups_per_thread; ++i) {
+        s = s * 1103515245u + 12345u;
+        if (find_user(names[(s >> 4) % (unsigned)nusers])) found++;
+    }
+    a->found = found;
+    return NULL;
+}
+
+static double run_threads(int nthreads, void *(*fn)(void *), long *found) {
+    pthread_t th[nthreads];
+    Arg args[nthreads];
+    double t0 = now_sec();
+    for (int i = 0; i < nthreads; ++i) {
+        args[i] = (Arg){ i, nthreads, 7919u * (i + 1), 0 };
+        pthread_create(&th[i], NULL, fn, &args[i]);
+    }
+    long total = 0;
+    for (int i = 0; i < nthreads; ++i) { pthread_join(th[i], NULL); total += args[i].found; }
+    if (found) *found = total;
+    return now_sec() - t0;
+}
+
+/* The registry as it was: one list, one mutex, strcmp scan. */
+typedef struct ListUser { char name[NAME_LEN]; struct ListUser *next; } ListUser;
+static ListUser *list_head;
+static pthread_mutex_t list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int list_insert(const char *name) {
+    pthread_mutex_lock(&list_mutex);
+    for (ListUser *u = list_head; u; u = u->next)
+        if (strcmp(u->name, name) == 0) { pthread_mutex_unlock(&list_mutex); return -1; }
+    ListUser *u = calloc(1, sizeof(ListUser));
+    strcpy(u->name, name);
+    u->next = list_head;
+    list_head = u;
+    pthread_mutex_unlock(&list_mutex);
+    return 0;
+}
+static ListUser *list_find(const char *name) {
+    pthread_mutex_lock(&list_mutex);
+    ListUser *u = list_head;
+    while (u && strcmp(u->name, name) != 0) u = u->next;
+    pthread_mutex_unlock(&list_mutex);
+    return u;
+}
+static void list_bench(int n) {
+    double t0 = now_sec();
+    for (int i = 0; i < n; ++i) list_insert(names[i]);
+    double ins = now_sec() - t0;
+    long lookups = 20000;
+    unsigned s = 1;
+    t0 = now_sec();
+    for (long i = 0; i < lookups; ++i) { s = s * 1103515245u + 12345u; list_find(names[(s >> 4) % (unsigned)n]); }
+    double look = now_sec() - t0;
+    printf("list   users=%-8d threads=1  create/s=%-12.0f lookup/s=%.0f\n", n, n / ins, lookups / look);
+    while (list_head) { ListUser *nx = list_head->next; free(list_head); list_head = nx; }
+}
+
+int main(int argc, char **argv) {
+    nusers = argc >= 2 ? atoi(argv[1]) : 1000000;
+    int max_threads = argc >= 3 ? atoi(argv[2]) : 4;
+    lookups_per_thread = argc >= 4 ? atol(argv[3]) : 2000000;
+    names = malloc((size_t)nusers * NAME_LEN);
+    if (!names) return 1;
+    for (int i = 0; i < nusers; ++i) snprintf(names[i], NAME_LEN, "user%07d", i);
+
+    for (int n = 1000; n <= LIST_MAX_USERS && n <= nusers; n *= 4) list_bench(n);
+
+    for (int th = 1; th <= max_threads; th *= 2) {
+        users_destroy();
+        double ins = run_threads(th, insert_fn, NULL);
+        long found;
+        double look = run_threads(th, lookup_fn, &found);
+        printf("hash   users=%-8d threads=%-2d create/s=%-12.0f lookup/s=%-12.0f (found %ld/%ld)\n",
+               nusers, th, nusers / ins, th * lookups_per_thread / look, found, th * lookups_per_thread);
+    }
+    users_destroy();
+    free(names);
+    return 0;
+}
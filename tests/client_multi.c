@@ -21,11 +21,24 @@ static void send_all(int sock, const void *buf, size_t len) {
     }
 }
 
-static ssize_t recv_line(int sock, char *buf, size_t maxlen) {
-    size_t n = 0; char c;
+typedef struct {
+    int sock;
+    char data[4096];
+    size_t start, end;
+} Reader;
+
+static ssize_t reader_fill(Reader *rd) {
+    if (rd->start == rd->end) rd->start = rd->end = 0;
+    ssize_t r = recv(rd->sock, rd->data + rd->end, sizeof(rd->data) - rd->end, 0);
+    if (r > 0) rd->end += r;
+    return r;
+}
+
+static ssize_t recv_line(Reader *rd, char *buf, size_t maxlen) {
+    size_t n = 0;
     while (n+1 < maxlen) {
-        ssize_t r = recv(sock, &c, 1, 0);
-        if (r <= 0) return -1;
+        if (rd->start == rd->end && reader_fill(rd) <= 0) return -1;
+        char c = rd->data[rd->start++];
         buf[n++] = c;
         if (c == '\n') break;
     }
@@ -33,6 +46,20 @@ static ssize_t recv_line(int sock, char *buf, size_t maxlen) {
     return n;
 }
 
+static ssize_t recv_all(Reader *rd, void *buf, size_t len) {
+    size_t total = 0;
+    char *p = buf;
+    while (total < len) {
+        if (rd->start == rd->end && reader_fill(rd) <= 0) break;
+        size_t n = rd->end - rd->start;
+        if (n > len - total) n = len - total;
+        memcpy(p + total, rd->data + rd->start, n);
+        rd->start += n;
+        total += n;
+    }
+    return total;
+}
+
 typedef struct {
     int id;
     const char *user;
@@ -44,10 +71,11 @@ void *worker(void *arg) {
     struct sockaddr_in sa; sa.sin_family = AF_INET; sa.sin_port = htons(DEFAULT_PORT); inet_pton(AF_INET, DEFAULT_SERVER, &sa.sin_addr);
     if (connect(sock, (struct sockaddr*)&sa, sizeof(sa)) < 0) { perror("connect"); return NULL; }
     char buf[1024];
+    Reader rd = { .sock = sock };
 
     char signup[128]; snprintf(signup, sizeof(signup), "SIGNUP %s\n", ta->user);
     send_all(sock, signup, strlen(signup));
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { close(sock); return NULL; }
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { close(sock); return NULL; }
 
     char fname[64];
     snprintf(fname, sizeof(fname), "file_%d.txt", ta->id);
@@ -56,34 +84,29 @@ void *worker(void *arg) {
     snprintf(cmd, sizeof(cmd), "UPLOAD %s %s %zu\n", ta->user, fname, strlen(payload));
     send_all(sock, cmd, strlen(cmd));
     send_all(sock, payload, strlen(payload));
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { close(sock); return NULL; }
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { close(sock); return NULL; }
 
     snprintf(cmd, sizeof(cmd), "LIST %s\n", ta->user);
     send_all(sock, cmd, strlen(cmd));
     while (1) {
-        if (recv_line(sock, buf, sizeof(buf)) <= 0) break;
+        if (recv_line(&rd, buf, sizeof(buf)) <= 0) break;
         if (strcmp(buf, "END\n") == 0) break;
     }
 
     snprintf(cmd, sizeof(cmd), "DOWNLOAD %s %s\n", ta->user, fname);
     send_all(sock, cmd, strlen(cmd));
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) { close(sock); return NULL; }
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) { close(sock); return NULL; }
     if (strncmp(buf, "OK ", 3) == 0) {
         size_t sz = 0;
         sscanf(buf+3, "%zu", &sz);
         char *d = malloc(sz+1);
-        size_t total = 0;
-        while (total < sz) {
-            ssize_t r = recv(sock, d + total, sz - total, 0);
-            if (r <= 0) break;
-            total += r;
-        }
+        size_t total = recv_all(&rd, d, sz);
         d[total] = '\0';
         free(d);
     }
     snprintf(cmd, sizeof(cmd), "DELETE %s %s\n", ta->user, fname);
     send_all(sock, cmd, strlen(cmd));
-    if (recv_line(sock, buf, sizeof(buf)) <= 0) {}
+    if (recv_line(&rd, buf, sizeof(buf)) <= 0) {}
     close(sock);
     return NULL;
 }